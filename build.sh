@@ -8,12 +8,23 @@ cp n64/src/config.h.in n64/src/config.h
 gcc -o bin/gfxdis.f3dex -DF3DEX_GBI -DNDEBUG -s -Os -flto -In64/src -In64/include n64/src/gfxdis/*.c
 
 # find-scenes
-gcc -o bin/find-scenes -s -Os -flto -Wall -Wextra src/find-scenes.c
+gcc -o bin/find-scenes -s -Os -flto -Wall -Wextra src/find-scenes.c src/scan.c src/stats.c src/claims.c src/opindex.c src/sigscan.c -pthread
 
 # extract-scenes
-gcc -o bin/extract-scenes -s -Os -flto -Wall -Wextra -Wno-missing-field-initializers src/extract-scenes.c
+gcc -o bin/extract-scenes -s -Os -flto -Wall -Wextra -Wno-missing-field-initializers src/extract-scenes.c src/roomconv.c src/ucode.c src/scan.c src/claims.c src/ripcache.c src/archive.c src/region.c src/stats.c -pthread
+
+# unpack-scenes
+gcc -o bin/unpack-scenes -s -Os -flto -Wall -Wextra src/unpack-scenes.c src/archive.c
 
 # convert-room
-gcc -o bin/convert-room -s -Os -flto -Wall -Wextra src/convert-room.c
+gcc -o bin/convert-room -s -Os -flto -Wall -Wextra src/convert-room.c src/roomconv.c src/ucode.c src/stats.c -pthread
+
+# make-dump
+gcc -o bin/make-dump -s -Os -flto -Wall -Wextra src/make-dump.c
 
+# bench-scenes
+gcc -o bin/bench-scenes -s -Os -flto -Wall -Wextra src/bench-scenes.c
 
+# fuzz-room (or, as a libFuzzer target:
+# clang -o bin/fuzz-room -g -O1 -fsanitize=fuzzer,address -DFUZZ_LIBFUZZER src/fuzz-room.c src/roomconv.c src/ucode.c src/stats.c -pthread)
+gcc -o bin/fuzz-room -s -Os -flto -Wall -Wextra src/fuzz-room.c src/roomconv.c src/ucode.c src/stats.c -pthread
@@ -0,0 +1,258 @@
+/*
+ * archive.c <z64.me>
+ *
+ * single-file archive of extracted scenes and rooms, with a table of
+ * contents at the end, so extracting doesn't create thousands of files
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+
+/* writes are gathered into batches of this many bytes */
+#define BATCH (8 << 20)
+
+/* ends every archive, after the offset and length of its contents */
+static const uint8_t magic[8] = { 'S', 'C', 'E', 'N', 'E', 'P', 'A', 'K' };
+
+/* size of what follows the table of contents */
+#define TRAILER (8 + 8 + sizeof(magic))
+
+/* little-endian u64 */
+static void wleu64(uint8_t *b, uint64_t v)
+{
+	int i;
+	
+	for (i = 0; i < 8; ++i)
+		b[i] = v >> (i * 8);
+}
+
+static uint64_t rleu64(const uint8_t *b)
+{
+	uint64_t v = 0;
+	int i;
+	
+	for (i = 0; i < 8; ++i)
+		v |= (uint64_t)b[i] << (i * 8);
+	
+	return v;
+}
+
+/* writes out the current batch */
+static void flush(struct archive *a)
+{
+	if (a->bufSz && !a->fail && fwrite(a->buf, 1, a->bufSz, a->fp) != a->bufSz)
+		a->fail = 1;
+	a->bufSz = 0;
+}
+
+/* appends bytes to the archive, batching small ones */
+static void append(struct archive *a, const void *dat, size_t sz)
+{
+	if (a->bufSz + sz > BATCH)
+		flush(a);
+	
+	/* anything too large to batch goes straight out */
+	if (sz > BATCH)
+	{
+		if (!a->fail && fwrite(dat, 1, sz, a->fp) != sz)
+			a->fail = 1;
+	}
+	else
+	{
+		memcpy(a->buf + a->bufSz, dat, sz);
+		a->bufSz += sz;
+	}
+	
+	a->ofs += sz;
+}
+
+int archiveCreate(struct archive *a, const char *fn)
+{
+	memset(a, 0, sizeof(*a));
+	
+	if (!(a->buf = malloc(BATCH)))
+		return -1;
+	
+	if (!(a->fp = fopen(fn, "wb")))
+	{
+		free(a->buf);
+		a->buf = 0;
+		return -1;
+	}
+	
+	return 0;
+}
+
+void archiveAdd(struct archive *a, const char *name, const void *dat, size_t sz)
+{
+	struct archiveEntry *e;
+	
+	if (a->entryNum == a->entryCap)
+	{
+		size_t cap = a->entryCap ? a->entryCap * 2 : 256;
+		void *tmp = realloc(a->entry, cap * sizeof(*a->entry));
+		
+		if (!tmp)
+		{
+			a->fail = 1;
+			return;
+		}
+		a->entry = tmp;
+		a->entryCap = cap;
+	}
+	
+	e = a->entry + a->entryNum;
+	if (!(e->name = strdup(name)))
+	{
+		a->fail = 1;
+		return;
+	}
+	e->ofs = a->ofs;
+	e->sz = sz;
+	++a->entryNum;
+	
+	append(a, dat, sz);
+}
+
+/* by name */
+static int compareEntry(const void *a, const void *b)
+{
+	const struct archiveEntry *x = a;
+	const struct archiveEntry *y = b;
+	
+	return strcmp(x->name, y->name);
+}
+
+int archiveFinish(struct archive *a)
+{
+	uint8_t w[TRAILER];
+	uint64_t tocOfs = a->ofs;
+	size_t i;
+	int fail;
+	
+	/* threads may have added files in any order */
+	qsort(a->entry, a->entryNum, sizeof(*a->entry), compareEntry);
+	
+	for (i = 0; i < a->entryNum; ++i)
+	{
+		size_t len = strlen(a->entry[i].name);
+		
+		wleu64(w + 0, a->entry[i].ofs);
+		wleu64(w + 8, a->entry[i].sz);
+		wleu64(w + 16, len);
+		append(a, w, 24);
+		append(a, a->entry[i].name, len);
+	}
+	
+	wleu64(w + 0, tocOfs);
+	wleu64(w + 8, a->entryNum);
+	memcpy(w + 16, magic, sizeof(magic));
+	append(a, w, TRAILER);
+	flush(a);
+	
+	fail = a->fail;
+	if (fclose(a->fp))
+		fail = 1;
+	a->fp = 0;
+	archiveClose(a);
+	
+	return fail ? -1 : 0;
+}
+
+int archiveOpen(struct archive *a, const char *fn)
+{
+	uint8_t w[TRAILER];
+	uint8_t *toc = 0;
+	uint8_t *b;
+	uint8_t *end;
+	long sz;
+	uint64_t tocOfs;
+	uint64_t num;
+	uint64_t i;
+	
+	memset(a, 0, sizeof(*a));
+	
+	if (!(a->fp = fopen(fn, "rb"))
+		|| fseek(a->fp, 0, SEEK_END)
+		|| (sz = ftell(a->fp)) < (long)TRAILER
+		|| fseek(a->fp, sz - TRAILER, SEEK_SET)
+		|| fread(w, 1, TRAILER, a->fp) != TRAILER
+		|| memcmp(w + 16, magic, sizeof(magic))
+		|| (tocOfs = rleu64(w)) > (uint64_t)(sz - TRAILER)
+		|| (num = rleu64(w + 8)) > (sz - TRAILER - tocOfs) / 24
+		|| !(toc = malloc(sz - TRAILER - tocOfs + 1))
+		|| fseek(a->fp, tocOfs, SEEK_SET)
+		|| fread(toc, 1, sz - TRAILER - tocOfs, a->fp) != sz - TRAILER - tocOfs
+		|| !(a->entry = calloc(num + 1, sizeof(*a->entry)))
+	)
+		goto fail;
+	
+	/* the table of contents, which is read in one go */
+	b = toc;
+	end = toc + (sz - TRAILER - tocOfs);
+	for (i = 0; i < num; ++i, ++a->entryNum)
+	{
+		struct archiveEntry *e = a->entry + i;
+		uint64_t len;
+		
+		if (end - b < 24)
+			goto fail;
+		e->ofs = rleu64(b);
+		e->sz = rleu64(b + 8);
+		len = rleu64(b + 16);
+		b += 24;
+		
+		if ((uint64_t)(end - b) < len
+			|| e->ofs > tocOfs
+			|| e->sz > tocOfs - e->ofs
+			|| !(e->name = malloc(len + 1))
+		)
+			goto fail;
+		memcpy(e->name, b, len);
+		e->name[len] = '\0';
+		b += len;
+	}
+	
+	free(toc);
+	return 0;
+	
+fail:
+	free(toc);
+	archiveClose(a);
+	return -1;
+}
+
+void *archiveRead(struct archive *a, const struct archiveEntry *e)
+{
+	void *dat;
+	
+	if (!(dat = malloc(e->sz + 1)))
+		return 0;
+	
+	if (fseek(a->fp, e->ofs, SEEK_SET)
+		|| fread(dat, 1, e->sz, a->fp) != e->sz
+	)
+	{
+		free(dat);
+		return 0;
+	}
+	
+	return dat;
+}
+
+void archiveClose(struct archive *a)
+{
+	size_t i;
+	
+	if (a->fp)
+		fclose(a->fp);
+	for (i = 0; i < a->entryNum; ++i)
+		free(a->entry[i].name);
+	free(a->entry);
+	free(a->buf);
+	memset(a, 0, sizeof(*a));
+}
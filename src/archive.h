@@ -0,0 +1,62 @@
+/*
+ * archive.h <z64.me>
+ *
+ * single-file archive of extracted scenes and rooms, with a table of
+ * contents at the end, so extracting doesn't create thousands of files
+ *
+ */
+
+#ifndef ARCHIVE_H_INCLUDED
+#define ARCHIVE_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* one file in an archive */
+struct archiveEntry {
+	char *name;             /* relative path, with / between directories */
+	uint64_t ofs;           /* where its bytes begin in the archive */
+	uint64_t sz;
+};
+
+/* an archive being written, or one that was read */
+struct archive {
+	FILE *fp;
+	uint8_t *buf;           /* writes are batched here */
+	size_t bufSz;
+	uint64_t ofs;           /* bytes written so far, including buf */
+	struct archiveEntry *entry;
+	size_t entryNum;
+	size_t entryCap;
+	int fail;               /* a write failed; the archive is unusable */
+};
+
+/* starts writing an archive
+ * returns 0 on success, non-zero on failure
+ */
+int archiveCreate(struct archive *a, const char *fn);
+
+/* appends a file; the caller serializes calls from multiple threads */
+void archiveAdd(struct archive *a, const char *name, const void *dat, size_t sz);
+
+/* writes the table of contents, sorted by name, and closes the file
+ * returns 0 on success, non-zero if anything along the way failed
+ */
+int archiveFinish(struct archive *a);
+
+/* reads the table of contents of an archive, leaving it open so files
+ * can be read with archiveRead()
+ * returns 0 on success, non-zero on failure
+ */
+int archiveOpen(struct archive *a, const char *fn);
+
+/* reads one file of an archive into a buffer the caller frees
+ * returns 0 on failure
+ */
+void *archiveRead(struct archive *a, const struct archiveEntry *e);
+
+/* closes an archive that was opened, and releases its contents */
+void archiveClose(struct archive *a);
+
+#endif /* ARCHIVE_H_INCLUDED */
@@ -0,0 +1,299 @@
+/*
+ * bench-scenes.c <z64.me>
+ *
+ * end-to-end benchmark: generates synthetic overdumps with make-dump,
+ * then times each stage of extracting them and records its peak memory
+ *
+ */
+
+#define _GNU_SOURCE /* nftw(), wait4() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define die(X) { fprintf(stderr, X"\n"); exit(EXIT_FAILURE); }
+
+/* the other tools are expected beside this one */
+static char gBin[PATH_MAX];
+
+/* timing and memory use of one stage, over every run */
+struct result {
+	double seconds;         /* average run */
+	long peakKiB;           /* largest peak rss of any run */
+};
+
+/* monotonic time in seconds */
+static double now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* runs one of the tools in dir, silently, and adds its time and peak
+ * memory use to r
+ * returns 0 on success, non-zero if it couldn't be run or failed
+ */
+static int run(struct result *r, const char *dir, char *const args[])
+{
+	struct rusage ru;
+	char path[PATH_MAX + 64];
+	double start;
+	int status;
+	pid_t pid;
+	
+	snprintf(path, sizeof(path), "%s/%s", gBin, args[0]);
+	
+	start = now();
+	if ((pid = fork()) < 0)
+		return -1;
+	if (!pid)
+	{
+		int null = open("/dev/null", O_WRONLY);
+		
+		if (chdir(dir) || null < 0)
+			_exit(127);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execv(path, args);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) != pid)
+		return -1;
+	
+	r->seconds += now() - start;
+	if (ru.ru_maxrss > r->peakKiB)
+		r->peakKiB = ru.ru_maxrss;
+	
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+	{
+		fprintf(stderr, "'%s' failed\n", args[0]);
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* nftw() callback, for removing directories */
+static int removeOne(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)st;
+	(void)type;
+	(void)ftw;
+	
+	return remove(path);
+}
+
+/* removes a directory and everything in it */
+static void removeAll(const char *path)
+{
+	nftw(path, removeOne, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* number and total size of the files in a directory, for nftw() */
+static unsigned gFiles;
+static size_t gBytes;
+static int addOne(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)path;
+	(void)ftw;
+	
+	if (type == FTW_F)
+	{
+		++gFiles;
+		gBytes += st->st_size;
+	}
+	
+	return 0;
+}
+
+/* prints a stage's results as a line of tab-separated values */
+static void report(unsigned mib, const char *stage, size_t bytes, const struct result *r)
+{
+	fprintf(stdout, "%u\t%s\t%lu\t%.4f\t%.1f\t%ld\n"
+		, mib
+		, stage
+		, (unsigned long)bytes
+		, r->seconds
+		, r->seconds > 0 ? bytes / r->seconds / (1 << 20) : 0
+		, r->peakKiB
+	);
+	fflush(stdout);
+}
+
+/* benchmarks every stage on a dump of the given size
+ * returns 0 on success, non-zero on failure
+ */
+static int bench(unsigned mib, unsigned runs, const char *seed, const char *jobs)
+{
+	char dir[] = "/tmp/bench-scenes.XXXXXX";
+	char path[sizeof(dir) + 64];
+	char size[16];
+	char scenes[16];
+	char **rooms = 0;
+	unsigned roomNum = 0;
+	size_t dumpBytes = (size_t)mib << 20;
+	size_t roomBytes;
+	unsigned i;
+	unsigned k;
+	int rval = -1;
+	
+	if (!mkdtemp(dir))
+		return -1;
+	
+	/* about one and a half scenes per MiB, like the real overdump */
+	snprintf(size, sizeof(size), "%u", mib);
+	snprintf(scenes, sizeof(scenes), "%u", mib * 3 / 2 ? mib * 3 / 2 : 1);
+	{
+		char *args[] = { "make-dump", "-s", (char*)seed, "-z", size, "-n", scenes
+			, "-m", "scenes.tsv", "-r", "rooms", "dump.z64", 0
+		};
+		struct result r = {0};
+		
+		snprintf(path, sizeof(path), "%s/rooms", dir);
+		if (mkdir(path, 0777) || run(&r, dir, args))
+			goto cleanup;
+	}
+	
+	/* every room written by make-dump, before conversion */
+	gFiles = 0;
+	gBytes = 0;
+	nftw(path, addOne, 16, FTW_PHYS);
+	roomBytes = gBytes;
+	if (!(rooms = calloc(gFiles + 1, sizeof(*rooms))))
+		goto cleanup;
+	for (roomNum = 0; roomNum < gFiles; ++roomNum)
+	{
+		char fn[64];
+		
+		snprintf(fn, sizeof(fn), "rooms/room_%u.zmap", roomNum);
+		if (!(rooms[roomNum] = strdup(fn)))
+			goto cleanup;
+	}
+	
+	/* scan: locating every scene */
+	{
+		char *args[] = { "find-scenes", "dump.z64", 0 };
+		struct result r = {0};
+		
+		for (i = 0; i < runs; ++i)
+			if (run(&r, dir, args))
+				goto cleanup;
+		r.seconds /= runs;
+		report(mib, "scan", dumpBytes, &r);
+	}
+	
+	/* rip: reading, patching, and converting, but writing nothing */
+	{
+		char *args[] = { "extract-scenes", "-j", (char*)jobs, "-n", "-m", "scenes.tsv"
+			, "-o", "/dev/null", "dump.z64", 0
+		};
+		struct result r = {0};
+		
+		for (i = 0; i < runs; ++i)
+			if (run(&r, dir, args))
+				goto cleanup;
+		r.seconds /= runs;
+		report(mib, "rip", dumpBytes, &r);
+	}
+	
+	/* convert: each room on its own, with convert-room */
+	{
+		struct result r = {0};
+		
+		for (i = 0; i < runs; ++i)
+		{
+			for (k = 0; k < roomNum; ++k)
+			{
+				char *args[] = { "convert-room", rooms[k], "converted.zmap", 0 };
+				
+				if (run(&r, dir, args))
+					goto cleanup;
+			}
+		}
+		r.seconds /= runs;
+		report(mib, "convert", roomBytes, &r);
+	}
+	
+	/* write: everything, into a tree of files */
+	{
+		char *args[] = { "extract-scenes", "-j", (char*)jobs, "-n", "-m", "scenes.tsv"
+			, "dump.z64", 0
+		};
+		struct result r = {0};
+		
+		snprintf(path, sizeof(path), "%s/scene", dir);
+		for (i = 0; i < runs; ++i)
+		{
+			removeAll(path);
+			if (run(&r, dir, args))
+				goto cleanup;
+		}
+		r.seconds /= runs;
+		report(mib, "write", dumpBytes, &r);
+	}
+	
+	rval = 0;
+cleanup:
+	for (k = 0; k < roomNum; ++k)
+		free(rooms[k]);
+	free(rooms);
+	removeAll(dir);
+	return rval;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *seed = "1";
+	const char *jobs = "1";
+	unsigned runs = 3;
+	char *slash;
+	int i;
+	
+	if (!realpath(argv[0], gBin) || !(slash = strrchr(gBin, '/')))
+		die("failed to locate the other tools");
+	*slash = '\0';
+	
+	/* options */
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (!strcmp(argv[1], "-r"))
+			runs = strtoul(argv[2], 0, 0);
+		else if (!strcmp(argv[1], "-s"))
+			seed = argv[2];
+		else if (!strcmp(argv[1], "-j"))
+			jobs = argv[2];
+		else
+			break;
+		argv += 2;
+		argc -= 2;
+	}
+	
+	if (!runs || (argc > 1 && argv[1][0] == '-'))
+		die("arguments: bench-scenes [-r runs] [-s seed] [-j N] [MiB...]");
+	
+	fprintf(stdout, "#MiB\tstage\tbytes\tseconds\tMiB/s\tpeak-KiB\n");
+	
+	/* sizes of dump to generate */
+	if (argc < 2)
+	{
+		if (bench(16, runs, seed, jobs) || bench(64, runs, seed, jobs))
+			die("benchmark failed");
+	}
+	for (i = 1; i < argc; ++i)
+		if (bench(strtoul(argv[i], 0, 0), runs, seed, jobs))
+			die("benchmark failed");
+	
+	return 0;
+}
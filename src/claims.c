@@ -0,0 +1,134 @@
+/*
+ * claims.c <z64.me>
+ *
+ * sorted set of claimed byte ranges, so scanning can skip over
+ * scenes and rooms that were already found without zeroing them
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "claims.h"
+
+/* index of the first claim ending after ofs */
+static size_t firstAfter(const struct claims *c, size_t ofs)
+{
+	size_t lo = 0;
+	size_t hi = c->num;
+	
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		
+		if (c->claim[mid].hi <= ofs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	return lo;
+}
+
+/* inserts a claim at index idx, which must keep the set sorted */
+static int insert(struct claims *c, size_t idx, size_t lo, size_t hi, size_t owner)
+{
+	if (c->num == c->cap)
+	{
+		size_t cap = c->cap ? c->cap * 2 : 64;
+		void *tmp = realloc(c->claim, cap * sizeof(*c->claim));
+		
+		if (!tmp)
+			return -1;
+		c->claim = tmp;
+		c->cap = cap;
+	}
+	
+	memmove(c->claim + idx + 1, c->claim + idx, (c->num - idx) * sizeof(*c->claim));
+	c->claim[idx].lo = lo;
+	c->claim[idx].hi = hi;
+	c->claim[idx].owner = owner;
+	++c->num;
+	
+	return 0;
+}
+
+void claimsFree(struct claims *c)
+{
+	free(c->claim);
+	c->claim = 0;
+	c->num = 0;
+	c->cap = 0;
+	c->conflictNum = 0;
+}
+
+const struct claim *claimsFind(const struct claims *c, size_t ofs)
+{
+	size_t idx = firstAfter(c, ofs);
+	
+	if (idx < c->num && c->claim[idx].lo <= ofs)
+		return c->claim + idx;
+	
+	return 0;
+}
+
+const struct claim *claimsFirst(const struct claims *c, size_t ofs)
+{
+	size_t idx = firstAfter(c, ofs);
+	
+	return idx < c->num ? c->claim + idx : 0;
+}
+
+int claimsAny(const struct claims *c, size_t lo, size_t hi)
+{
+	size_t idx = firstAfter(c, lo);
+	
+	return lo < hi && idx < c->num && c->claim[idx].lo < hi;
+}
+
+int claimsAdd(struct claims *c, size_t lo, size_t hi, size_t owner)
+{
+	size_t idx = firstAfter(c, lo);
+	
+	/* fill each gap between existing claims overlapping [lo, hi) */
+	while (lo < hi)
+	{
+		struct claim *next = idx < c->num ? c->claim + idx : 0;
+		size_t gapEnd = (next && next->lo < hi) ? next->lo : hi;
+		
+		if (lo < gapEnd)
+		{
+			/* extend the previous claim instead, if it is adjacent */
+			if (idx
+				&& c->claim[idx - 1].hi == lo
+				&& c->claim[idx - 1].owner == owner
+			)
+				c->claim[idx - 1].hi = gapEnd;
+			else if (insert(c, idx++, lo, gapEnd, owner))
+				return -1;
+			lo = gapEnd;
+			continue;
+		}
+		
+		/* overlaps an existing claim */
+		if (next->owner != owner)
+		{
+			size_t end = next->hi < hi ? next->hi : hi;
+			
+			++c->conflictNum;
+			if (c->report)
+				fprintf(c->report
+					, "conflict: %08X claims %08X-%08X, already claimed by %08X\n"
+					, (unsigned)owner
+					, (unsigned)lo
+					, (unsigned)end
+					, (unsigned)next->owner
+				);
+		}
+		lo = next->hi;
+		++idx;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * claims.h <z64.me>
+ *
+ * sorted set of claimed byte ranges, so scanning can skip over
+ * scenes and rooms that were already found without zeroing them
+ *
+ */
+
+#ifndef CLAIMS_H_INCLUDED
+#define CLAIMS_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* bytes [lo, hi) claimed by the scene at owner */
+struct claim {
+	size_t lo;
+	size_t hi;
+	size_t owner;
+};
+
+/* disjoint claims, sorted by address */
+struct claims {
+	struct claim *claim;
+	size_t num;
+	size_t cap;
+	size_t conflictNum;     /* overlapping claims by different owners */
+	FILE *report;           /* conflicts are described here, if non-zero */
+};
+
+/* releases a claim set; it is left empty and can be reused */
+void claimsFree(struct claims *c);
+
+/* returns the claim containing ofs, or 0 if it is unclaimed */
+const struct claim *claimsFind(const struct claims *c, size_t ofs);
+
+/* returns the first claim ending after ofs, or 0 if there is none;
+ * the claims after it follow in address order
+ */
+const struct claim *claimsFirst(const struct claims *c, size_t ofs);
+
+/* returns non-zero if any byte in [lo, hi) is claimed */
+int claimsAny(const struct claims *c, size_t lo, size_t hi);
+
+/* claims [lo, hi) for owner; bytes claimed by another owner are
+ * reported as a conflict and stay with their original owner
+ * returns 0 on success, non-zero on failure
+ */
+int claimsAdd(struct claims *c, size_t lo, size_t hi, size_t owner);
+
+#endif /* CLAIMS_H_INCLUDED */
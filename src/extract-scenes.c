@@ -8,7 +8,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fnmatch.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "roomconv.h"
+#include "ucode.h"
+#include "claims.h"
+#include "scan.h"
+#include "ripcache.h"
+#include "archive.h"
+#include "region.h"
+#include "stats.h"
 
 #define MODIFY_SCENES
 #define MODIFY_ROOMS
@@ -16,10 +30,72 @@
 
 #define DOORSTRIDE_0x0E 0xE
 
+/* bump whenever ripScene() changes what it writes, so that cached rips
+ * made before then are ignored
+ */
+#define RIP_REVISION 1
+
+/* what cached rooms and scenes depend on, besides their own bytes */
+#define STR(X) #X
+#define XSTR(X) STR(X)
+#ifdef MODIFY_SCENES
+#define STAMP_MODIFY_SCENES " modify-scenes"
+#else
+#define STAMP_MODIFY_SCENES ""
+#endif
+#ifdef MODIFY_ROOMS
+#define STAMP_MODIFY_ROOMS " modify-rooms"
+#else
+#define STAMP_MODIFY_ROOMS ""
+#endif
+#ifdef CONVERT_ROOMS
+#define STAMP_CONVERT_ROOMS " convert-rooms"
+#else
+#define STAMP_CONVERT_ROOMS ""
+#endif
+#define ROOM_STAMP "rip " XSTR(RIP_REVISION) " roomconv " XSTR(ROOMCONV_REVISION) \
+	STAMP_MODIFY_ROOMS STAMP_CONVERT_ROOMS
+#define SCENE_STAMP ROOM_STAMP STAMP_MODIFY_SCENES
+
 struct scene {
 	unsigned offset;
-	const char *name;
+	char *name;             /* from the manifest; 0 if it isn't listed */
 	int doorStride;
+	unsigned lo;            /* bytes ripScene() reads or writes */
+	unsigned hi;
+	struct scene *chain;    /* next scene sharing any of those bytes */
+	int selected;           /* matched by --only */
+	int quiet;              /* ripped only for its effect on later scenes */
+};
+
+/* scenes to be ripped, in address order once discovery is done */
+struct scenelist {
+	struct scene *scene;
+	int num;
+	int cap;
+	int fail;               /* ran out of memory while discovering */
+};
+
+/* a scene list hashed by name and by offset, for --only */
+struct sceneindex {
+	int *byName;            /* list index + 1 of each scene, or 0 */
+	int *byOffset;
+	size_t mask;
+};
+
+/* a worker's scratch memory, reused from one scene to the next */
+struct arena {
+	unsigned char *dat;
+	size_t cap;
+};
+
+/* scenes are handed out to worker threads one chain at a time */
+struct pool {
+	struct region *rom;
+	struct scene **chain;
+	int chainNum;
+	int next;               /* next chain to be ripped */
+	pthread_mutex_t lock;
 };
 
 /* big-endian bytes to u16 */
@@ -41,7 +117,7 @@ static inline void wbeU16(void *bytes, unsigned v)
 static inline unsigned beU32(void *bytes)
 {
 	unsigned char *b = bytes;
-	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+	return ((unsigned)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
 }
 
 /* write u32 as big-endian bytes */
@@ -72,30 +148,10 @@ static inline void *pointer(void *scene, void *bytes)
 	return ((char*)scene) + ofs;
 }
 
-/* minimal file loader
- * returns 0 on failure
- * returns pointer to loaded file on success
- */
-void *loadfile(const char *fn, size_t *sz)
+/* non-zero if sz bytes at p lie within work, which holds [lo, hi) */
+static inline int inWork(unsigned char *work, unsigned lo, unsigned hi, unsigned char *p, size_t sz)
 {
-	FILE *fp;
-	void *dat;
-	
-	/* rudimentary error checking returns 0 on any error */
-	if (
-		!fn
-		|| !sz
-		|| !(fp = fopen(fn, "rb"))
-		|| fseek(fp, 0, SEEK_END)
-		|| !(*sz = ftell(fp))
-		|| fseek(fp, 0, SEEK_SET)
-		|| !(dat = malloc(*sz))
-		|| fread(dat, 1, *sz, fp) != *sz
-		|| fclose(fp)
-	)
-		return 0;
-	
-	return dat;
+	return p && p >= work && sz <= hi - lo && (size_t)(p - work) <= hi - lo - sz;
 }
 
 /* minimal file writer
@@ -120,21 +176,21 @@ int savefile(const char *fn, const void *dat, const size_t sz)
 	return 1;
 }
 
-void clearActorObject(void *room)
+void clearActorObject(void *room, unsigned roomSz)
 {
 #ifndef MODIFY_ROOMS
 	return;
 #endif
 	unsigned char *b;
+	unsigned char *end = (unsigned char*)room + (roomSz & ~7);
 	
-	for (b = room; *b != 0x14; b += 8)
+	for (b = room; b < end && *b != 0x14; b += 8)
 		if (*b == 0x01 || *b == 0x0B)
 			b[1] = 0;
 }
 
-const char *binstr16(unsigned short v)
+const char *binstr16(unsigned short v, char wow[17])
 {
-	static char wow[17];
 	int i;
 	
 	for (i = 0; i < 16; ++i)
@@ -144,11 +200,270 @@ const char *binstr16(unsigned short v)
 	return wow;
 }
 
-void ripScene(void *rom, unsigned sceneOfs, const char *name, int doorStride)
+/* grow [lo, hi) to contain [a, b) */
+static void extend(unsigned *lo, unsigned *hi, unsigned a, unsigned b)
+{
+	if (a < *lo)
+		*lo = a;
+	if (b > *hi)
+		*hi = b;
+}
+
+/* determine the range of bytes ripScene() reads or writes for a scene;
+ * scenes whose ranges are disjoint can safely be ripped concurrently;
+ * only the header and room list are read to do so
+ */
+void sceneExtent(struct region *rom, struct scene *item)
+{
+	unsigned char *b = rom->dat;
+	size_t romSz = rom->sz;
+	unsigned char *scene = b + item->offset;
+	unsigned char *w;
+	unsigned lo = item->offset;
+	unsigned hi = item->offset;
+	unsigned doorNum = 0;
+	unsigned sceneEnd = 0;
+	int doorStride = item->doorStride ? item->doorStride : 16;
+	int i;
+	
+	for (w = scene; w + 8 <= b + romSz; w += 8)
+	{
+		unsigned ofs;
+		
+		/* each command is read in as it is reached */
+		if (regionLoad(rom, w - b, w - b + 8) || *w == 0x14)
+			break;
+		ofs = beU32(w + 4) & 0xffffff;
+		
+		/* link list */
+		if (*w == 0x00)
+			extend(&lo, &hi, item->offset + ofs, item->offset + ofs + w[1] * 16);
+		/* door list */
+		else if (*w == 0x0e)
+		{
+			doorNum = w[1];
+			extend(&lo, &hi, item->offset + ofs, item->offset + ofs + doorNum * doorStride);
+		}
+		/* collision header */
+		else if (*w == 0x03)
+			extend(&lo, &hi, item->offset + ofs, item->offset + ofs + 0x2c);
+		/* room list */
+		else if (*w == 0x04)
+		{
+			unsigned char *roomList = scene + ofs;
+			
+			extend(&lo, &hi, item->offset + ofs, item->offset + ofs + w[1] * 8);
+			if (regionLoad(rom, item->offset + ofs, item->offset + ofs + w[1] * 8))
+				break;
+			for (i = 0; i < w[1] && roomList + 8 <= b + romSz; ++i, roomList += 8)
+				extend(&lo, &hi, beU32(roomList), beU32(roomList + 4));
+			
+			if (w[1] && scene + ofs + 8 <= b + romSz)
+				sceneEnd = beU32(scene + ofs);
+		}
+	}
+	
+	/* the rebuilt door list is written past the end of the scene */
+	if (sceneEnd)
+		extend(&lo, &hi, sceneEnd, sceneEnd + 16 * doorNum);
+	
+	/* the header itself */
+	extend(&lo, &hi, item->offset, (w - b) + 8);
+	
+	item->lo = lo;
+	item->hi = hi > romSz ? romSz : hi;
+}
+
+/* bytes of the scenes and rooms ripped so far; older versions zeroed
+ * them in the rom instead, which later overlapping scenes depended on
+ */
+static struct claims gClaims = {0};
+static pthread_mutex_t gClaimsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* zero any bytes in [lo, hi) that earlier scenes already claimed, so an
+ * overlapping scene sees exactly what it would have if they were zeroed;
+ * work holds a copy of those bytes
+ */
+static void unclaimedOnly(unsigned char *work, unsigned lo, unsigned hi)
+{
+	const struct claim *c;
+	const struct claim *end;
+	
+	pthread_mutex_lock(&gClaimsLock);
+	end = gClaims.claim + gClaims.num;
+	for (c = claimsFirst(&gClaims, lo); c && c < end && c->lo < hi; ++c)
+	{
+		size_t a = c->lo > lo ? c->lo : lo;
+		size_t b = c->hi < hi ? c->hi : hi;
+		
+		memset(work + (a - lo), 0, b - a);
+	}
+	pthread_mutex_unlock(&gClaimsLock);
+}
+
+/* claims [lo, hi) for the scene at owner */
+static void claim(unsigned lo, unsigned hi, unsigned owner)
+{
+	pthread_mutex_lock(&gClaimsLock);
+	gClaims.report = stderr;
+	if (claimsAdd(&gClaims, lo, hi, owner))
+		fprintf(stderr, "failed to claim %08X-%08X\n", lo, hi);
+	pthread_mutex_unlock(&gClaimsLock);
+}
+
+/* directory of earlier rips, if caching them */
+static const char *gCacheDir = 0;
+
+/* microcodes rooms are converted between, which cached rips depend on */
+static const char *gUcode = UCODE_DEFAULT;
+
+/* ROOMCONV_* flags rooms are converted with, which they depend on too */
+static int gRoomFlags = 0;
+
+/* archive everything is written to, if not individual files */
+static struct archive *gArchive = 0;
+static pthread_mutex_t gArchiveLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* make a scene's directory */
+static void makedir(const char *dir)
+{
+	if (gArchive || !dir)
+		return;
+	
+	mkdir("scene", 0777);
+	mkdir(dir, 0777);
+}
+
+/* write a file to a scene's directory, logging it if the rip is cached */
+static void output(struct riplog *log, const char *dir, const char *fn, const void *dat, size_t sz)
 {
 	char buf[1024];
-	unsigned char *b = rom;
-	unsigned char *scene = b + sceneOfs;
+	double start;
+	
+	if (log)
+		riplogFile(log, fn, dat, sz);
+	
+	/* quiet rips have no directory */
+	if (!dir)
+		return;
+	
+	start = statsNow();
+	sprintf(buf, "%s/%s", dir, fn);
+	if (gArchive)
+	{
+		pthread_mutex_lock(&gArchiveLock);
+		archiveAdd(gArchive, buf, dat, sz);
+		pthread_mutex_unlock(&gArchiveLock);
+	}
+	else
+		savefile(buf, dat, sz);
+	statsAdd(STAT_WRITTEN, sz);
+	statsSpan("write", start, "%s", buf);
+}
+
+/* claim bytes for a scene, logging it if the rip is cached */
+static void claimLogged(struct riplog *log, unsigned lo, unsigned hi, unsigned owner)
+{
+	claim(lo, hi, owner);
+	
+	if (log)
+		riplogClaim(log, lo, hi);
+}
+
+/* clears a room's actor/object lists and converts it in place, unless
+ * the same bytes were converted before; rooms don't depend on anything
+ * outside themselves, so identical rooms anywhere share an entry
+ * returns 0 on success, non-zero if the room is left unconverted
+ */
+static int convertRoom(unsigned char *room, unsigned roomSz, unsigned sceneOfs, int i)
+{
+	struct ripkey key;
+	void *cached;
+	size_t cachedSz;
+	double start = statsNow();
+#ifdef CONVERT_ROOMS
+	void *orig;
+#endif
+
+	statsAdd(STAT_ROOMS, 1);
+	if (gCacheDir)
+	{
+		ripkeyInit(&key, ROOM_STAMP);
+		ripkeyAdd(&key, gUcode, strlen(gUcode));
+		ripkeyNum(&key, gRoomFlags);
+		ripkeyAdd(&key, room, roomSz);
+		if ((cached = ripcacheGet(gCacheDir, &key, &cachedSz)))
+		{
+			if (cachedSz == roomSz)
+				memcpy(room, cached, roomSz);
+			free(cached);
+			if (cachedSz == roomSz)
+			{
+				statsAdd(STAT_ROOMS_CACHED, 1);
+				statsSpan("room", start, "room %d of %08X (cached)", i, sceneOfs);
+				return 0;
+			}
+		}
+	}
+	
+	/* clear actor/object lists in room file */
+	clearActorObject(room, roomSz);
+	
+	/* convert room in place; one that fails partway is put back as it
+	 * was, rather than written half converted
+	 */
+#ifdef CONVERT_ROOMS
+	if (!(orig = malloc(roomSz)))
+	{
+		fprintf(stderr, "out of memory for room %d of %08X\n", i, sceneOfs);
+		return -1;
+	}
+	memcpy(orig, room, roomSz);
+	if (roomconv(room, roomSz, gRoomFlags))
+	{
+		/* neither the room nor its scene is cached, so it's retried */
+		memcpy(room, orig, roomSz);
+		free(orig);
+		fprintf(stderr, "failed to convert room %d of %08X, writing it unconverted\n", i, sceneOfs);
+		statsSpan("room", start, "room %d of %08X (failed)", i, sceneOfs);
+		return -1;
+	}
+	free(orig);
+#else
+	(void)sceneOfs;
+	(void)i;
+#endif
+
+	if (gCacheDir && ripcachePut(gCacheDir, &key, room, roomSz))
+		fprintf(stderr, "failed to cache room %d of %08X\n", i, sceneOfs);
+	
+	statsSpan("room", start, "room %d of %08X", i, sceneOfs);
+	return 0;
+}
+
+/* does again everything a cached rip did */
+static void replay(unsigned sceneOfs, const char *dir, const struct riplog *log)
+{
+	size_t i;
+	
+	if (log->fileNum)
+		makedir(dir);
+	for (i = 0; i < log->fileNum; ++i)
+		output(0, dir, log->file[i].name, log->file[i].dat, log->file[i].sz);
+	
+	for (i = 0; i < log->claimNum; ++i)
+		claim(log->claim[i].lo, log->claim[i].hi, sceneOfs);
+}
+
+/* rips a scene and its rooms into dir, patching them in work, which
+ * holds a copy of rom bytes [lo, hi); log is non-zero if it is cached
+ * returns the number of rooms that failed to convert
+ */
+static int rip(struct riplog *log, unsigned char *work, unsigned lo, unsigned hi, unsigned sceneOfs, const char *dir, int doorStride)
+{
+	char buf[1024];
+	unsigned char *scene = work + (sceneOfs - lo);
+	unsigned char *end = work + (hi - lo);
 	unsigned char *w;
 	unsigned char *roomList;
 	unsigned char roomNum;
@@ -158,10 +473,13 @@ void ripScene(void *rom, unsigned sceneOfs, const char *name, int doorStride)
 	unsigned char *linkList = 0;
 	unsigned char linkNum = 0;
 	unsigned sceneSz;
+	int failed = 0;
 	int i;
 	
-	/* grab pointers to other things */
-	for (w = scene; *w != 0x14; w += 8)
+	/* grab pointers to other things; nothing past the bytes read in is
+	 * walked, even if the header is missing its end command
+	 */
+	for (w = scene; w + 8 <= end && *w != 0x14; w += 8)
 	{
 		/* link list */
 		if (*w == 0x00)
@@ -185,54 +503,85 @@ void ripScene(void *rom, unsigned sceneOfs, const char *name, int doorStride)
 #endif
 	}
 	
+	/* whatever would be patched must lie within the bytes read in */
+	if (linkList && !inWork(work, lo, hi, linkList, linkNum * 16))
+	{
+		fprintf(stderr, "link list of %08X is out of range\n", sceneOfs);
+		linkList = 0;
+	}
+	if (collHeader && !inWork(work, lo, hi, collHeader, 0x2c))
+	{
+		fprintf(stderr, "collision header of %08X is out of range\n", sceneOfs);
+		collHeader = 0;
+	}
+	if (doorCmd
+		&& !inWork(work, lo, hi, pointer(scene, doorCmd + 4), doorNum * (doorStride ? doorStride : 16))
+	)
+	{
+		fprintf(stderr, "door list of %08X is out of range\n", sceneOfs);
+		doorCmd = 0;
+	}
+	
 	/* walk header */
-	for (w = scene; *w != 0x14; w += 8)
+	for (w = scene; w + 8 <= end && *w != 0x14; w += 8)
 		if (*w == 0x04)
 			break;
 	
 	/* no room list found */
-	if (*w != 0x04)
-		return;
+	if (w + 8 > end || *w != 0x04)
+		return 0;
 	
 	/* room list details */
 	roomNum = w[1];
 	roomList = pointer(scene, w + 4);
 	
 	if (!roomNum || !roomList)
-		return;
+		return 0;
 	
-	/* make directory */
-	system("mkdir -p scene");
-	sprintf(buf, "mkdir -p \"scene/%08X - %s\"", sceneOfs, name);
-	system(buf);
+	if (!inWork(work, lo, hi, roomList, roomNum * 8))
+	{
+		fprintf(stderr, "room list of %08X is out of range\n", sceneOfs);
+		return 0;
+	}
 	
-	/* get scene size */
+	/* get scene size; the rebuilt door list goes past its end */
 	sceneSz = beU32(roomList) - sceneOfs;
+	if (beU32(roomList) < sceneOfs
+		|| !inWork(work, lo, hi, scene, sceneSz + (doorCmd ? doorNum * 16 : 0))
+	)
+	{
+		fprintf(stderr, "scene %08X is out of range\n", sceneOfs);
+		return 0;
+	}
+	
+	/* make directory */
+	makedir(dir);
 	
 	/* write room_%d.zmap for each room */
 	//fprintf(stdout, "%s = %d room%s\n", name, roomNum, (roomNum>1)?"s":"");
 	//fprintf(stdout, "%s\n", name);
 	for (i = 0; i < roomNum; ++i, roomList += 8)
 	{
-		char buf1[4096];
 		unsigned start = beU32(roomList);
 		unsigned end   = beU32(roomList + 4);
 		
-		/* clear actor/object lists in room file */
-		clearActorObject(b + start);
+		/* only past the end of a truncated rom */
+		if (start < lo || end > hi || end < start)
+		{
+			fprintf(stderr, "room %d of %08X is out of range\n", i, sceneOfs);
+			continue;
+		}
 		
-		/* write room file to folder */
-		sprintf(buf, "scene/%08X - %s/room_%d.zmap", sceneOfs, name, i);
-		savefile(buf, b + start, end - start);
+		/* clear actor/object lists and convert */
+		if (convertRoom(work + (start - lo), end - start, sceneOfs, i))
+			++failed;
 		
-		/* convert dumped room */
-#ifdef CONVERT_ROOMS
-		sprintf(buf1, "bin/convert-room \"%s\" \"%s\"", buf, buf);
-		system(buf1);
-#endif
+		/* write room file to folder */
+		sprintf(buf, "room_%d.zmap", i);
+		output(log, dir, buf, work + (start - lo), end - start);
 		
-		/* zero the room */
-		memset(b + start, 0, end - start);
+		/* claim the room */
+		claimLogged(log, start, end, sceneOfs);
 	}
 	
 	/* collision header is present */
@@ -296,7 +645,7 @@ void ripScene(void *rom, unsigned sceneOfs, const char *name, int doorStride)
 			//if (doorStride == DOORSTRIDE_0x0E)
 				wbeU16(newDoor + 14, var);
 			
-			//fprintf(stdout, "%04x %04x %s\n", oldActor, oldVar, binstr16(oldVar));
+			//fprintf(stdout, "%04x %04x %s\n", oldActor, oldVar, binstr16(oldVar, wow));
 			
 			sceneSz += 16;
 		}
@@ -309,96 +658,856 @@ void ripScene(void *rom, unsigned sceneOfs, const char *name, int doorStride)
 		}
 	}
 #endif
-	
+
 	/* write scene.zscene to directory */
-	sprintf(buf, "scene/%08X - %s/scene.zscene", sceneOfs, name);
-	savefile(buf, scene, sceneSz);
+	output(log, dir, "scene.zscene", scene, sceneSz);
+	
+	/* claim the scene so i can search for others */
+	claimLogged(log, sceneOfs, sceneOfs + sceneSz, sceneOfs);
+	
+	return failed;
+}
+
+/* readies an arena for a scene needing sz bytes; what it held before is
+ * gone, but the memory is reused, so it only grows to the largest scene
+ * returns pointer to the bytes on success, or 0 on failure
+ */
+static unsigned char *arenaReset(struct arena *arena, size_t sz)
+{
+	if (sz > arena->cap)
+	{
+		free(arena->dat);
+		arena->cap = sz * 2;
+		if (!(arena->dat = malloc(arena->cap)))
+			arena->cap = 0;
+	}
 	
-	/* zero out the scene so i can search for others */
-	memset(scene, 0, sceneSz);
+	return arena->dat;
+}
+
+void ripScene(struct region *rom, struct arena *arena, const struct scene *item)
+{
+	struct scene extent = *item;
+	unsigned sceneOfs = item->offset;
+	const char *name = item->name;
+	int doorStride = item->doorStride;
+	struct riplog log = {0};
+	struct ripkey key;
+	unsigned char *work;
+	size_t workSz;
+	char path[1024];
+	const char *dir = path;
+	double start = statsNow();
+	int failed;
+	
+	/* everything the rip touches is read in, and nothing else */
+	sceneExtent(rom, &extent);
+	if (extent.hi <= sceneOfs || regionLoad(rom, extent.lo, extent.hi))
+	{
+		fprintf(stderr, "failed to read scene %08X\n", sceneOfs);
+		return;
+	}
+	
+	/* the rom is never written; patches are made to a copy of the bytes */
+	workSz = extent.hi - extent.lo;
+	if (!(work = arenaReset(arena, workSz)))
+	{
+		fprintf(stderr, "out of memory for scene %08X\n", sceneOfs);
+		return;
+	}
+	memcpy(work, rom->dat + extent.lo, workSz);
+	
+	/* if this scene shares bytes with one ripped earlier, it sees them zeroed */
+	unclaimedOnly(work, extent.lo, extent.hi);
+	statsSpan("read", start, "read %08X-%08X", extent.lo, extent.hi);
+	statsAdd(STAT_RIPPED, 1);
+	
+	/* scenes missing from the manifest are known only by offset */
+	if (name)
+		sprintf(path, "scene/%08X - %s", sceneOfs, name);
+	else
+	{
+		sprintf(path, "scene/%08X", sceneOfs);
+		if (!doorStride)
+			fprintf(stderr, "scene %08X isn't in the manifest, assuming 16-byte doors\n", sceneOfs);
+	}
+	if (item->quiet)
+		dir = 0;
+	
+	/* a rip is a function of the bytes it reads, so if those are the
+	 * same as in an earlier rip, what that rip did is done again
+	 */
+	if (gCacheDir)
+	{
+		ripkeyInit(&key, SCENE_STAMP);
+		ripkeyAdd(&key, gUcode, strlen(gUcode));
+		ripkeyNum(&key, gRoomFlags);
+		ripkeyNum(&key, sceneOfs);
+		ripkeyNum(&key, extent.lo);
+		ripkeyNum(&key, extent.hi);
+		ripkeyNum(&key, doorStride);
+		ripkeyAdd(&key, work, workSz);
+		
+		if (!riplogGet(&log, gCacheDir, &key))
+		{
+			replay(sceneOfs, dir, &log);
+			riplogFree(&log);
+			statsAdd(STAT_RIPS_CACHED, 1);
+			statsSpan("scene", start, "%s (cached)", path);
+			return;
+		}
+	}
+	
+	failed = rip(gCacheDir ? &log : 0, work, extent.lo, extent.hi, sceneOfs, dir, doorStride);
+	
+	/* a scene with unconverted rooms would be replayed as is, so it
+	 * isn't cached, and they are retried on the next run
+	 */
+	if (gCacheDir)
+	{
+		if (!failed && riplogPut(&log, gCacheDir, &key))
+			fprintf(stderr, "failed to cache scene %08X\n", sceneOfs);
+		riplogFree(&log);
+	}
+	
+	statsSpan("scene", start, "%s", path);
+}
+
+/* worker thread; rips chains until there are none left */
+static void *ripChains(void *arg)
+{
+	struct pool *pool = arg;
+	struct arena arena = {0};
+	
+	for (;;)
+	{
+		struct scene *item;
+		int which;
+		
+		pthread_mutex_lock(&pool->lock);
+		which = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		
+		if (which >= pool->chainNum)
+			break;
+		
+		/* scenes sharing bytes are ripped in list order */
+		for (item = pool->chain[which]; item; item = item->chain)
+			ripScene(pool->rom, &arena, item);
+	}
+	
+	free(arena.dat);
+	return 0;
+}
+
+/* rip every scene using a pool of worker threads; scenes whose byte
+ * ranges overlap (e.g. deku tree overwriting dodongo's cavern) are
+ * chained and ripped by one worker in list order, so the output is
+ * identical to that of ripping the list serially
+ */
+int ripScenesParallel(struct region *rom, struct scene *list, int listNum, int jobs)
+{
+	struct pool pool = {0};
+	struct scene **tail = 0;
+	pthread_t *thread = 0;
+	int *group = 0;
+	int budget = jobs;
+	int i;
+	int k;
+	
+	if (!(group = malloc(listNum * sizeof(*group)))
+		|| !(tail = malloc(listNum * sizeof(*tail)))
+		|| !(pool.chain = malloc(listNum * sizeof(*pool.chain)))
+		|| !(thread = malloc(jobs * sizeof(*thread)))
+	)
+	{
+		free(pool.chain);
+		free(thread);
+		free(group);
+		free(tail);
+		return -1;
+	}
+	
+	/* group scenes transitively sharing bytes, keyed by first member */
+	for (i = 0; i < listNum; ++i)
+	{
+		sceneExtent(rom, list + i);
+		list[i].chain = 0;
+		group[i] = i;
+	}
+	for (i = 0; i < listNum; ++i)
+	{
+		for (k = 0; k < i; ++k)
+		{
+			int a = group[i];
+			int b = group[k];
+			int n;
+			
+			if (a == b
+				|| list[i].hi <= list[k].lo
+				|| list[k].hi <= list[i].lo
+			)
+				continue;
+			
+			/* merge into whichever group comes first in the list */
+			if (b < a)
+			{
+				n = a;
+				a = b;
+				b = n;
+			}
+			for (n = 0; n < listNum; ++n)
+				if (group[n] == b)
+					group[n] = a;
+		}
+	}
+	
+	/* link each group into a chain, in list order */
+	for (i = 0; i < listNum; ++i)
+	{
+		if (group[i] == i)
+		{
+			pool.chain[pool.chainNum++] = list + i;
+			tail[i] = list + i;
+		}
+		else
+		{
+			tail[group[i]]->chain = list + i;
+			tail[group[i]] = list + i;
+		}
+	}
+	
+	pool.rom = rom;
+	pthread_mutex_init(&pool.lock, 0);
+	
+	if (jobs > pool.chainNum)
+		jobs = pool.chainNum;
+	
+	/* the workers split the threads between them, so large rooms only
+	 * spread across threads that no worker needs
+	 */
+	if (jobs)
+		roomconvThreads(budget / jobs);
+	
+	for (i = 0; i < jobs; ++i)
+		if (pthread_create(thread + i, 0, ripChains, &pool))
+			break;
+	
+	/* if threads couldn't be created, this thread does the work */
+	if (i < jobs)
+		ripChains(&pool);
+	
+	while (i--)
+		pthread_join(thread[i], 0);
+	
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.chain);
+	free(thread);
+	free(group);
+	free(tail);
+	
+	return 0;
+}
+
+/* append a scene to a list
+ * returns pointer to it on success, or 0 on failure
+ */
+static struct scene *scenelistAdd(struct scenelist *l, unsigned offset, char *name, int doorStride)
+{
+	struct scene *item;
+	
+	if (l->num == l->cap)
+	{
+		int cap = l->cap ? l->cap * 2 : 64;
+		void *tmp = realloc(l->scene, cap * sizeof(*l->scene));
+		
+		if (!tmp)
+			return 0;
+		l->scene = tmp;
+		l->cap = cap;
+	}
+	
+	item = l->scene + l->num++;
+	memset(item, 0, sizeof(*item));
+	item->offset = offset;
+	item->name = name;
+	item->doorStride = doorStride;
+	
+	return item;
+}
+
+/* releases a list and the names in it */
+static void scenelistFree(struct scenelist *l)
+{
+	int i;
+	
+	for (i = 0; i < l->num; ++i)
+		free(l->scene[i].name);
+	free(l->scene);
+	memset(l, 0, sizeof(*l));
+}
+
+/* reads the scenes listed in a manifest, one per line:
+ * offset <tab> door stride <tab> name
+ * the offset and door stride are hex, and a door stride of - means
+ * the usual 16 bytes; blank lines and lines beginning with # are ignored
+ * returns 0 on success, non-zero on failure
+ */
+static int manifestLoad(struct scenelist *l, const char *fn)
+{
+	FILE *fp;
+	char line[512];
+	int lineNum = 0;
+	
+	if (!(fp = fopen(fn, "r")))
+	{
+		fprintf(stderr, "failed to open '%s'\n", fn);
+		return -1;
+	}
+	
+	while (fgets(line, sizeof(line), fp))
+	{
+		char *next;
+		char *name;
+		unsigned offset;
+		int doorStride = 0;
+		
+		++lineNum;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!*line || *line == '#')
+			continue;
+		
+		offset = strtoul(line, &next, 16);
+		if (*next == '\t' && next[1] == '-')
+			next += 2;
+		else if (*next == '\t')
+			doorStride = strtoul(next + 1, &next, 16);
+		else
+			next = line;
+		
+		if (next == line || *next != '\t' || !next[1])
+		{
+			fprintf(stderr, "%s:%d: expected offset, door stride, name\n", fn, lineNum);
+			fclose(fp);
+			return -1;
+		}
+		
+		if (!(name = strdup(next + 1))
+			|| !scenelistAdd(l, offset, name, doorStride)
+		)
+		{
+			free(name);
+			fclose(fp);
+			return -1;
+		}
+	}
+	
+	fclose(fp);
+	return 0;
+}
+
+/* the manifest used when none is given: scenes.tsv in the working
+ * directory, or else the one shipped beside bin/, where build.sh puts
+ * the executable
+ * returns its path, or 0 if there's neither
+ */
+static const char *manifestDefault(const char *argv0)
+{
+	static char path[4096];
+	const char *slash = strrchr(argv0, '/');
+	FILE *fp;
+	
+	if ((fp = fopen("scenes.tsv", "r")))
+	{
+		fclose(fp);
+		return "scenes.tsv";
+	}
+	
+	if (!slash || slash - argv0 + sizeof("/../scenes.tsv") > sizeof(path))
+		return 0;
+	
+	sprintf(path, "%.*s/../scenes.tsv", (int)(slash - argv0), argv0);
+	if (!(fp = fopen(path, "r")))
+		return 0;
+	fclose(fp);
+	
+	return path;
+}
+
+/* a scene was found by the scan; any whose room list runs off into
+ * nonsense is left alone, because ripScene() would follow it
+ */
+static void discovered(struct scan *s, const struct found *f)
+{
+	struct scenelist *l = s->udata;
+	
+	if (f->roomValid == f->roomNum
+		&& !scenelistAdd(l, f->scene, 0, 0)
+	)
+		l->fail = 1;
+}
+
+/* address order, with the manifest's copy of a discovered scene first */
+static int sceneCompare(const void *a, const void *b)
+{
+	const struct scene *x = a;
+	const struct scene *y = b;
+	
+	if (x->offset != y->offset)
+		return x->offset < y->offset ? -1 : 1;
+	
+	return !x->name - !y->name;
+}
+
+/* puts a list in address order, which is the order the hand-maintained
+ * list was always in, dropping discovered scenes the manifest names
+ */
+static void scenelistSort(struct scenelist *l)
+{
+	int i;
+	int k;
+	
+	qsort(l->scene, l->num, sizeof(*l->scene), sceneCompare);
+	
+	for (i = k = 0; i < l->num; ++i)
+	{
+		if (k && !l->scene[i].name && l->scene[k - 1].offset == l->scene[i].offset)
+			continue;
+		l->scene[k++] = l->scene[i];
+	}
+	l->num = k;
+}
+
+/* case-insensitive FNV-1a */
+static unsigned hashName(const char *name)
+{
+	unsigned h = 0x811c9dc5;
+	
+	while (*name)
+		h = (h ^ tolower((unsigned char)*name++)) * 0x01000193;
+	
+	return h;
+}
+
+static unsigned hashOffset(unsigned offset)
+{
+	offset *= 0x9e3779b1;
+	
+	return offset ^ (offset >> 16);
+}
+
+/* hashes every scene in a list by name and by offset; scenes sharing
+ * either are all kept, further along the same probe sequence
+ * returns 0 on success, non-zero on failure
+ */
+static int sceneindexInit(struct sceneindex *x, const struct scenelist *l)
+{
+	size_t cap = 16;
+	size_t k;
+	int i;
+	
+	while (cap < (size_t)l->num * 2)
+		cap *= 2;
+	
+	x->mask = cap - 1;
+	x->byName = calloc(cap, sizeof(*x->byName));
+	x->byOffset = calloc(cap, sizeof(*x->byOffset));
+	if (!x->byName || !x->byOffset)
+		return -1;
+	
+	for (i = 0; i < l->num; ++i)
+	{
+		if (l->scene[i].name)
+		{
+			for (k = hashName(l->scene[i].name) & x->mask; x->byName[k]; k = (k + 1) & x->mask)
+				;
+			x->byName[k] = i + 1;
+		}
+		
+		for (k = hashOffset(l->scene[i].offset) & x->mask; x->byOffset[k]; k = (k + 1) & x->mask)
+			;
+		x->byOffset[k] = i + 1;
+	}
+	
+	return 0;
+}
+
+static void sceneindexFree(struct sceneindex *x)
+{
+	free(x->byName);
+	free(x->byOffset);
+	memset(x, 0, sizeof(*x));
+}
+
+/* lowercase copy of a string, truncated to fit */
+static char *lower(char *dst, const char *src, size_t sz)
+{
+	size_t i;
+	
+	for (i = 0; src[i] && i + 1 < sz; ++i)
+		dst[i] = tolower((unsigned char)src[i]);
+	dst[i] = '\0';
+	
+	return dst;
+}
+
+/* selects every scene matching spec, which is a scene's name, its offset
+ * in hex, or a glob matched against its folder name ("offset - name")
+ * without regard to case
+ * returns the number of scenes selected
+ */
+static int sceneindexSelect(struct sceneindex *x, struct scenelist *l, const char *spec)
+{
+	struct scene *item;
+	char *next;
+	unsigned offset;
+	size_t k;
+	int num = 0;
+	
+	/* globs are tried against every scene */
+	if (strpbrk(spec, "*?["))
+	{
+		char pattern[512];
+		char folder[1024];
+		char buf[1024];
+		
+		lower(pattern, spec, sizeof(pattern));
+		for (item = l->scene; item < l->scene + l->num; ++item)
+		{
+			if (item->name)
+				snprintf(buf, sizeof(buf), "%08X - %s", item->offset, item->name);
+			else
+				snprintf(buf, sizeof(buf), "%08X", item->offset);
+			
+			if (!fnmatch(pattern, lower(folder, buf, sizeof(folder)), 0))
+			{
+				item->selected = 1;
+				++num;
+			}
+		}
+		
+		return num;
+	}
+	
+	/* names, then offsets, are looked up */
+	for (k = hashName(spec) & x->mask; x->byName[k]; k = (k + 1) & x->mask)
+	{
+		item = l->scene + x->byName[k] - 1;
+		if (!strcasecmp(item->name, spec))
+		{
+			item->selected = 1;
+			++num;
+		}
+	}
+	if (num)
+		return num;
+	
+	offset = strtoul(spec, &next, 16);
+	if (next == spec || *next)
+		return 0;
+	for (k = hashOffset(offset) & x->mask; x->byOffset[k]; k = (k + 1) & x->mask)
+	{
+		item = l->scene + x->byOffset[k] - 1;
+		if (item->offset == offset)
+		{
+			item->selected = 1;
+			++num;
+		}
+	}
+	
+	return num;
+}
+
+/* narrows a list down to the scenes selected by specs, plus any earlier
+ * scenes whose bytes they (transitively) share, which are ripped quietly
+ * so the selected scenes come out exactly as in a full run; only headers
+ * and room lists are read to determine this
+ * returns 0 on success, non-zero on failure
+ */
+static int scenelistSelect(struct scenelist *l, struct region *rom, char **spec, int specNum)
+{
+	struct sceneindex x = {0};
+	int *need;
+	int i;
+	int k;
+	
+	if (!(need = calloc(l->num + 1, sizeof(*need)))
+		|| sceneindexInit(&x, l)
+	)
+	{
+		free(need);
+		sceneindexFree(&x);
+		return -1;
+	}
+	
+	for (i = 0; i < specNum; ++i)
+	{
+		if (!sceneindexSelect(&x, l, spec[i]))
+		{
+			fprintf(stderr, "no scene matches '%s'\n", spec[i]);
+			free(need);
+			sceneindexFree(&x);
+			return -1;
+		}
+	}
+	sceneindexFree(&x);
+	
+	for (i = 0; i < l->num; ++i)
+		sceneExtent(rom, l->scene + i);
+	
+	/* walking backwards catches scenes needed by needed scenes */
+	for (i = l->num - 1; i >= 0; --i)
+	{
+		if (!l->scene[i].selected && !need[i])
+			continue;
+		need[i] = 1;
+		
+		for (k = 0; k < i; ++k)
+			if (l->scene[i].hi > l->scene[k].lo && l->scene[k].hi > l->scene[i].lo)
+				need[k] = 1;
+	}
+	
+	for (i = k = 0; i < l->num; ++i)
+	{
+		if (!need[i])
+		{
+			free(l->scene[i].name);
+			continue;
+		}
+		l->scene[i].quiet = !l->scene[i].selected;
+		l->scene[k++] = l->scene[i];
+	}
+	l->num = k;
+	
+	free(need);
+	return 0;
+}
+
+/* scans the rom for scene headers, the same way find-scenes does, and
+ * adds any the manifest doesn't already list; the file is streamed
+ * through a window rather than loaded, so none of it stays in memory
+ * returns 0 on success, non-zero on failure
+ */
+static int discover(struct scenelist *l, struct region *rom)
+{
+	struct scan s;
+	int rval;
+	
+	scanInit(&s, 0, 0, 0);
+	s.claims.report = 0;
+	s.found = discovered;
+	s.udata = l;
+	rval = scanStream(&s, rom->fd);
+	scanStats(&s);
+	claimsFree(&s.claims);
+	
+	/* the scan reads all of the rom, though none of it is kept */
+	statsAdd(STAT_READ, s.scanned);
+	
+	if (rval || l->fail)
+		return -1;
+	
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
-	void *rom;
-	size_t romSz;
+	struct region rom;
+	struct scenelist list = {0};
 	struct scene *item;
-	struct scene list[] = {
-		{ 0x010FA150, "fstdan", DOORSTRIDE_0x0E }
-		, { 0x0116BF80, "dodongo's cavern" }
-		, { 0x011D7CA0, "stalfos" }
-		, { 0x011E6860, "stalfos-1" }
-		, { 0x011F2C30, "test map with 3D ladders" }
-		, { 0x01200B10, "prototype deku tree" }
-		, { 0x01209B40, "gohma" }
-		, { 0x01213480, "depth test" }
-		, { 0x0125EE70, "prerendered shop" }
-		, { 0x012875B0, "newer hyrule field" } /* has alt headers */
-		, { 0x012B1C30, "kakariko" }
-		, { 0x012D2DF0, "graveyard" }
-		, { 0x012E8A70, "lost woods" }
-		, { 0x0130C490, "kokiri forest" }
-		, { 0x01335A90, "sacred forest meadow" }
-		, { 0x0133CD40, "lake house" }
-		, { 0x01356E50, "zora's river" }
-		, { 0x0135D420, "fishing pond" }
-		, { 0x01366200, "gerudo valley" }
-		, { 0x0138EFC0, "hyrule castle exterior" }
-		, { 0x013A8AA0, "death mountain" }
-		, { 0x013C2D50, "death mountain crater" } /* old format */
-		, { 0x013E4860, "cave with stalactites" } /* broken link var (change 00ff -> 0fff) */
-		, { 0x013E74B0, "cave" } /* sanguinetti missed this one */
-		, { 0x013F4780, "prerendered market" }
-		, { 0x013F8FC0, "another prerendered market" }
-		, { 0x013FC0C0, "fire temple", DOORSTRIDE_0x0E }
-		, { 0x01516950, "forest temple", DOORSTRIDE_0x0E }
-		, { 0x0160BB40, "horseback archery" }
-		, { 0x0161B1E0, "srd test" } /* old format */
-		, { 0x016225B0, "textureless scene" } /* old format */
-		, { 0x01624320, "test room treasure chests" }
-		, { 0x016336C0, "deku tree" } /* overwrite dodongo's cavern */
-		, { 0x016AA080, "jabu jabu test" } /* old format */
-		, { 0x016AD480, "chamber of sages" }
-		, { 0x016BF4E0, "temple of time exterior" }
-		, { 0x016C36C0, "fountain" }
-		, { 0x016D0CC0, "temple of time" }
-		, { 0x016E1C10, "forest temple maze" }
-		, { 0x016ECFE0, "wood floor" } /* old format */
-		, { 0x016EED40, "forest temple room" }
-		, { 0x016F6BA0, "fire temple maze" }
-		, { 0x01733F00, "kokiri prerender" }
-		, { 0x0175B4C0, "another kokiri prerender" }
-		, { 0x017856A0, "draw order test" }
-		, { 0x01789C10, "older hyrule field" }
-		, { 0x017C6920, "cave c"/*"fire temple cave"*/ }
-		, { 0x017D3120, "water temple", DOORSTRIDE_0x0E } /* works best over spirit temple */
-		, { 0x018C2CA0, "prerendered area" }
-		, { 0x018EE2C0, "grotto" }
-		, { 0x018F9B10, "gerudo training grounds" }
-		, { 0x0197D860, "prerendered market entrance" }
-	};
-	struct scene *listEnd = list + sizeof(list) / sizeof(*list);
-	
-	if (argc != 2 || !argv[1])
-	{
-		fprintf(stderr, "arguments: extract-scenes \"your/F-Zero X Overdump.z64\"\n");
+	struct scene *listEnd;
+	const char *self = argv[0];
+	const char *manifest = 0;
+	const char *cache = 0;
+	const char *pack = 0;
+	struct archive archive;
+	struct arena arena = {0};
+	const char *trace = 0;
+	int stats = 0;
+	int jobs = 1;
+	int listedOnly = 0;
+	char **only;
+	int onlyNum = 0;
+	double start;
+	
+	/* there can't be more --only options than arguments */
+	if (!(only = malloc(argc * sizeof(*only))))
 		return EXIT_FAILURE;
+	
+	/* options */
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		/* rip only the scenes in the manifest, without scanning */
+		if (!strcmp(argv[1], "-n"))
+		{
+			listedOnly = 1;
+			++argv;
+			--argc;
+			continue;
+		}
+		
+		/* the external converter, one gfxdis/gfxasm run per room */
+		if (!strcmp(argv[1], "--batch"))
+		{
+			gRoomFlags |= ROOMCONV_BATCH;
+			++argv;
+			--argc;
+			continue;
+		}
+		
+		/* smaller, cheaper display lists */
+		if (!strcmp(argv[1], "--optimize"))
+		{
+			gRoomFlags |= ROOMCONV_OPTIMIZE;
+			++argv;
+			--argc;
+			continue;
+		}
+		
+		/* where the time goes, printed to stderr when done */
+		if (!strcmp(argv[1], "--stats"))
+		{
+			stats = 1;
+			++argv;
+			--argc;
+			continue;
+		}
+		
+		if (!strcmp(argv[1], "-j"))
+			jobs = atoi(argv[2]);
+		else if (!strcmp(argv[1], "-m"))
+			manifest = argv[2];
+		else if (!strcmp(argv[1], "-c"))
+			cache = argv[2];
+		else if (!strcmp(argv[1], "-o"))
+			pack = argv[2];
+		else if (!strcmp(argv[1], "--only"))
+			only[onlyNum++] = argv[2];
+		else if (!strcmp(argv[1], "--trace"))
+			trace = argv[2];
+		else if (!strcmp(argv[1], "--ucode"))
+		{
+			const struct ucodePair *p = ucodePairFind(argv[2]);
+			
+			if (!p || roomconvUcode(p->name))
+			{
+				fprintf(stderr, "unsupported microcode pair '%s'; try one of: %s\n"
+					, argv[2], ucodePairList()
+				);
+				return EXIT_FAILURE;
+			}
+			gUcode = p->name;
+		}
+		else
+			break;
+		argv += 2;
+		argc -= 2;
+	}
+	
+	/* names and door strides come from the shipped list unless told otherwise */
+	if (!manifest && (manifest = manifestDefault(self)))
+		fprintf(stderr, "no -m given, using '%s'\n", manifest);
+	
+	if (argc != 2 || !argv[1] || jobs < 1 || (listedOnly && !manifest))
+	{
+		fprintf(stderr, "arguments: extract-scenes [-j N] [-m scenes.tsv [-n]] [-c cache-dir] [-o scenes.pak] [--only scene]... [--ucode from:to] [--batch] [--optimize] [--stats] [--trace out.json] \"your/F-Zero X Overdump.z64\"\n");
+		return EXIT_FAILURE;
+	}
+	
+	/* gfxdis and gfxasm are only built for the default pair */
+	if ((gRoomFlags & ROOMCONV_BATCH) && strcmp(gUcode, UCODE_DEFAULT))
+	{
+		fprintf(stderr, "--batch only handles " UCODE_DEFAULT "\n");
+		return EXIT_FAILURE;
+	}
+	
+	if ((gRoomFlags & ROOMCONV_BATCH) && !roomconvBatchSupported())
+	{
+		fprintf(stderr, "gfxdis doesn't take -n, converting without batching\n");
+		gRoomFlags = (gRoomFlags & ~ROOMCONV_BATCH) | ROOMCONV_REFERENCE;
+	}
+	
+	statsBegin(stats, trace);
+	
+	start = statsNow();
+	if (manifest && manifestLoad(&list, manifest))
+		return EXIT_FAILURE;
+	
+	/* unchanged scenes and rooms are restored from here */
+	if (cache)
+	{
+		mkdir(cache, 0777);
+		gCacheDir = cache;
 	}
 	
-	rom = loadfile(argv[1], &romSz);
-	if (!rom)
+	/* only the parts of the rom that are ripped are ever read in */
+	if (regionOpen(&rom, argv[1]))
 	{
 		fprintf(stderr, "failed to open '%s'\n", argv[1]);
 		return EXIT_FAILURE;
 	}
 	
-	for (item = list; item < listEnd; ++item)
-		ripScene(rom, item->offset, item->name, item->doorStride);
+	/* one pass over the rom finds every scene worth ripping */
+	if (!listedOnly && discover(&list, &rom))
+	{
+		fprintf(stderr, "failed to scan '%s'\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	scenelistSort(&list);
+	
+	/* if only some scenes are wanted, nothing else is read or ripped */
+	if (onlyNum && scenelistSelect(&list, &rom, only, onlyNum))
+		return EXIT_FAILURE;
+	listEnd = list.scene + list.num;
+	statsSpan("stage", start, "discover %d scenes", list.num);
+	
+	/* everything goes into one archive instead of a directory tree */
+	if (pack)
+	{
+		if (archiveCreate(&archive, pack))
+		{
+			fprintf(stderr, "failed to create '%s'\n", pack);
+			return EXIT_FAILURE;
+		}
+		gArchive = &archive;
+	}
+	
+	start = statsNow();
+	if (jobs > 1)
+	{
+		if (ripScenesParallel(&rom, list.scene, list.num, jobs))
+		{
+			fprintf(stderr, "failed to start worker threads\n");
+			return EXIT_FAILURE;
+		}
+	}
+	else
+	{
+		for (item = list.scene; item < listEnd; ++item)
+			ripScene(&rom, &arena, item);
+	}
 	
 	/* write a modified rom with scene files zero'd (debugging purposes) */
-	//savefile("zero-scenes.z64", rom, romSz);
+	//regionLoad(&rom, 0, rom.sz);
+	//unclaimedOnly(rom.dat, 0, rom.sz);
+	//savefile("zero-scenes.z64", rom.dat, rom.sz);
 	
-	free(rom);
-	return EXIT_SUCCESS;
+	claimsFree(&gClaims);
+	scenelistFree(&list);
+	free(arena.dat);
+	free(only);
+	statsSpan("stage", start, "rip");
+	
+	start = statsNow();
+	if (gArchive && archiveFinish(gArchive))
+	{
+		fprintf(stderr, "failed to write '%s'\n", pack);
+		return EXIT_FAILURE;
+	}
+	statsSpan("stage", start, "finish");
+	
+	statsAdd(STAT_READ, rom.readBytes);
+	regionClose(&rom);
+	
+	return statsEnd(stderr) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
-
@@ -9,6 +9,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+
+#include "scan.h"
+#include "opindex.h"
+#include "sigscan.h"
+#include "stats.h"
 
 #define die(X) { fprintf(stderr, X"\n"); exit(EXIT_FAILURE); }
 
@@ -38,6 +50,48 @@ void *loadfile(const char *fn, size_t *sz)
 	return dat;
 }
 
+/* maps a file into memory read-only; claimed regions are tracked
+ * separately rather than zeroed, so the pages can be shared, and
+ * they are only read in as the scan reaches them
+ * returns 0 on failure
+ * returns pointer to mapped file on success
+ */
+void *mapfile(const char *fn, size_t *sz, int huge)
+{
+	struct stat st;
+	void *dat;
+	int fd;
+	
+	if (!fn || !sz || (fd = open(fn, O_RDONLY)) < 0)
+		return 0;
+	
+	if (fstat(fd, &st) || st.st_size <= 0)
+	{
+		close(fd);
+		return 0;
+	}
+	
+	*sz = st.st_size;
+	dat = mmap(0, *sz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if (dat == MAP_FAILED)
+		return 0;
+	
+	/* the scan is front to back */
+	madvise(dat, *sz, MADV_SEQUENTIAL);
+
+#ifdef MADV_HUGEPAGE
+	/* optional; ignored where unsupported */
+	if (huge)
+		madvise(dat, *sz, MADV_HUGEPAGE);
+#else
+	(void)huge;
+#endif
+
+	return dat;
+}
+
 /* read big-endian u32 */
 uint32_t rbeu32(void *data)
 {
@@ -46,155 +100,837 @@ uint32_t rbeu32(void *data)
 	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | (b[3]);
 }
 
-/* retrieve data pointed to by a scene segment
- * returns 0 if out of bounds or if invalid segment pointer
+/* searches for scene header pattern and prints findings */
+void findheaders(uint8_t *datBegin, size_t datSz)
+{
+	struct scan s;
+	
+	scanInit(&s, datBegin, datSz, stdout);
+	scanAll(&s);
+	scanStats(&s);
+	claimsFree(&s.claims);
+}
+
+/* same as findheaders(), but streamed from a file descriptor
+ * returns 0 on success, non-zero on failure
  */
-void *scenesegment(uint8_t *datBegin, uint8_t *datEnd, uint8_t *scene, void *ptr)
+int findheadersStream(int fd)
 {
-	uint32_t addr = rbeu32(ptr);
-	uint8_t *dat = scene + (addr & 0xffffff);
+	struct scan s;
+	int rval;
 	
-	if (!ptr)
-		return 0;
+	scanInit(&s, 0, 0, stdout);
+	rval = scanStream(&s, fd);
+	scanStats(&s);
+	claimsFree(&s.claims);
 	
-	/* invalid segment pointer */
-	if ((addr >> 24) != 0x02)
-		return 0;
+	return rval;
+}
+
+/* monotonic time in seconds */
+static double now(void)
+{
+	struct timespec ts;
 	
-	/* out of bounds */
-	if (dat < datBegin || dat >= datEnd)
-		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 	
-	return dat;
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-/* searches for scene header pattern and prints findings */
-void findheaders(uint8_t *datBegin, size_t datSz)
+/* one input of a corpus scan */
+struct corpusfile {
+	char *name;
+	char *result;           /* tab-separated findings */
+	size_t resultSz;
+};
+
+/* a batch of inputs, scanned concurrently */
+struct corpus {
+	struct corpusfile *file;
+	size_t fileNum;
+	size_t fileCap;
+	size_t next;            /* next file to be scanned */
+	pthread_mutex_t lock;
+};
+
+/* add a file to a corpus; directories contribute every file within
+ * them, recursively and sorted by name so results are repeatable;
+ * links met along the way are skipped, so a loop can't recurse forever
+ * returns 0 on success, non-zero on failure
+ */
+static int corpusAdd(struct corpus *c, const char *path)
 {
-	uint8_t *dat;
-	uint8_t *datEnd = datBegin + datSz;
-	const uint8_t endmarker[] = { 0x14, 0, 0, 0, 0, 0, 0, 0};
-	
-	#define STRIDE 8 /* length of a header command */
+	struct stat st;
+	struct dirent **ent;
+	int entNum;
 	
-	for (dat = datBegin ; dat < datEnd; dat += STRIDE)
+	if (!stat(path, &st)
+		&& S_ISDIR(st.st_mode)
+		&& (entNum = scandir(path, &ent, 0, alphasort)) >= 0
+	)
 	{
-		/* potential scene header end marker match */
-		if (!memcmp(dat, endmarker, sizeof(endmarker)))
+		int fail = 0;
+		int i;
+		
+		for (i = 0; i < entNum; ++i)
 		{
-			uint8_t *bounds = dat - 32 * STRIDE;
-			uint8_t *roomlist = 0;
-			uint8_t *scene = 0;
-			uint8_t *sceneEnd = 0;
-			uint8_t *walk;
-			uint8_t roomnum = 0;
-			uint8_t i;
-			unsigned datAddr;
-			
-			/* take care to avoid buffer underflow */
-			if (bounds < datBegin)
-				bounds = datBegin;
+			struct stat lst;
+			char *sub;
 			
-			/* walk backwards for a max of 32 unique header commands
-			 * to confirm whether the structure matches what's typical
-			 */
-			for (walk = dat; walk > bounds; walk -= STRIDE)
+			if (!fail
+				&& strcmp(ent[i]->d_name, ".")
+				&& strcmp(ent[i]->d_name, "..")
+			)
 			{
-				switch (*walk)
+				if (!(sub = malloc(strlen(path) + strlen(ent[i]->d_name) + 2)))
+					fail = 1;
+				else
 				{
-					case 0x04:
-						roomlist = walk + 4;
-						roomnum = walk[1];
-						scene = walk; /* some scenes begin with this command */
-						break;
-					
-					/* some scenes actually lack these commands */
-					case 0x15:
-					case 0x18:
-						scene = walk;
-						break;
+					sprintf(sub, "%s/%s", path, ent[i]->d_name);
+					if (lstat(sub, &lst) || !S_ISLNK(lst.st_mode))
+						fail = corpusAdd(c, sub);
+					free(sub);
 				}
 			}
+			free(ent[i]);
+		}
+		free(ent);
+		
+		return fail;
+	}
+	
+	/* anything else, even if unreadable, gets a result */
+	if (c->fileNum == c->fileCap)
+	{
+		size_t cap = c->fileCap ? c->fileCap * 2 : 64;
+		void *tmp = realloc(c->file, cap * sizeof(*c->file));
+		
+		if (!tmp)
+			return -1;
+		c->file = tmp;
+		c->fileCap = cap;
+	}
+	
+	memset(c->file + c->fileNum, 0, sizeof(*c->file));
+	if (!(c->file[c->fileNum].name = strdup(path)))
+		return -1;
+	++c->fileNum;
+	
+	return 0;
+}
+
+/* scans one input of a corpus into its own result buffer */
+static void corpusScan(struct corpusfile *f)
+{
+	struct scan s;
+	const char *status = "ok";
+	double start = now();
+	double spanStart = statsNow();
+	FILE *out;
+	int fd;
+	
+	if (!(out = open_memstream(&f->result, &f->resultSz)))
+		return;
+	
+	scanInit(&s, 0, 0, out);
+	s.name = f->name;
+	s.claims.report = 0;
+	
+	/* streamed, so a file truncated mid-scan is a read error, not a crash */
+	if ((fd = open(f->name, O_RDONLY)) < 0)
+		status = "unreadable";
+	else
+	{
+		if (scanStream(&s, fd))
+			status = "read error";
+		close(fd);
+	}
+	
+	fprintf(out, "file\t%s\t%lu\t%lu\t%lu\t%.6f\t%s\n"
+		, f->name
+		, (unsigned long)s.datSz
+		, (unsigned long)s.sceneNum
+		, (unsigned long)s.claims.conflictNum
+		, now() - start
+		, status
+	);
+	
+	scanStats(&s);
+	statsSpan("file", spanStart, "%s", f->name);
+	claimsFree(&s.claims);
+	fclose(out);
+}
+
+/* worker thread; scans files until there are none left */
+static void *corpusRun(void *arg)
+{
+	struct corpus *c = arg;
+	
+	for (;;)
+	{
+		size_t which;
+		
+		pthread_mutex_lock(&c->lock);
+		which = c->next++;
+		pthread_mutex_unlock(&c->lock);
+		
+		if (which >= c->fileNum)
+			break;
+		
+		corpusScan(c->file + which);
+	}
+	
+	return 0;
+}
+
+/* scans every file in paths, which may include directories, across
+ * jobs threads and prints one combined tab-separated result, in the
+ * order the files were given; a file that can't be read is reported
+ * as such and doesn't stop the batch
+ * returns 0 on success, non-zero on failure
+ */
+int findheadersCorpus(char *paths[], int pathNum, int jobs)
+{
+	struct corpus c = {0};
+	pthread_t *thread;
+	size_t i;
+	int started;
+	int k;
+	
+	for (k = 0; k < pathNum; ++k)
+		if (corpusAdd(&c, paths[k]))
+			return -1;
+	
+	if (!(thread = calloc(jobs, sizeof(*thread))))
+		return -1;
+	
+	pthread_mutex_init(&c.lock, 0);
+	for (started = 1; started < jobs; ++started)
+		if (pthread_create(thread + started, 0, corpusRun, &c))
+			break;
+	corpusRun(&c);
+	for (k = 1; k < started; ++k)
+		pthread_join(thread[k], 0);
+	pthread_mutex_destroy(&c.lock);
+	
+	fprintf(stdout, "#scene\tfile\toffset\trooms\n");
+	fprintf(stdout, "#room\tfile\tscene\tindex\toffset\tsize\n");
+	fprintf(stdout, "#file\tfile\tbytes\tscenes\tconflicts\tseconds\tstatus\n");
+	for (i = 0; i < c.fileNum; ++i)
+	{
+		struct corpusfile *f = c.file + i;
+		
+		if (f->result)
+			fwrite(f->result, 1, f->resultSz, stdout);
+		else
+			fprintf(stdout, "file\t%s\t0\t0\t0\t0\tout of memory\n", f->name);
+		free(f->result);
+		free(f->name);
+	}
+	
+	free(c.file);
+	free(thread);
+	
+	return 0;
+}
+
+/* one thread's share of a partitioned scan */
+struct chunk {
+	uint8_t *begin;
+	uint8_t *end;
+	uint8_t **marker;       /* every end marker in [begin, end) */
+	size_t markerNum;
+	size_t markerCap;
+	int fail;
+};
+
+/* worker thread; collects the end markers in a chunk */
+static void *scanchunk(void *arg)
+{
+	struct chunk *c = arg;
+	findmarker_t *findmarker = findmarkerSelect(0);
+	double start = statsNow();
+	uint8_t *dat;
+	
+	for (dat = findmarker(c->begin, c->end)
+		; dat + STRIDE <= c->end
+		; dat = findmarker(dat + STRIDE, c->end)
+	)
+	{
+		if (c->markerNum == c->markerCap)
+		{
+			size_t cap = c->markerCap ? c->markerCap * 2 : 256;
+			void *tmp = realloc(c->marker, cap * sizeof(*c->marker));
 			
-			/* missing start command, so not a scene */
-			if (!scene)
-				continue;
-			
-			/* not 64-bit aligned, so not a scene */
-			datAddr = (unsigned)(scene - datBegin);
-			if (datAddr & 0xf)
-				continue;
+			if (!tmp)
+			{
+				c->fail = 1;
+				break;
+			}
+			c->marker = tmp;
+			c->markerCap = cap;
+		}
+		c->marker[c->markerNum++] = dat;
+	}
+	
+	statsSpan("scan", start, "%lu end markers", (unsigned long)c->markerNum);
+	
+	return 0;
+}
+
+/* same as findheaders(), but the buffer is split into chunks whose
+ * end markers are located concurrently; claiming a scene zeroes bytes
+ * that later matches depend on, so the candidates are then resolved
+ * one at a time in address order against the claims so far, exactly
+ * as the serial scan would; claiming never creates a marker, so no
+ * match the serial scan would find is missed
+ * returns 0 on success, non-zero on failure
+ */
+int findheadersParallel(uint8_t *datBegin, size_t datSz, int jobs)
+{
+	struct scan s;
+	struct chunk *chunk;
+	pthread_t *thread;
+	size_t share;
+	double start;
+	int started;
+	int fail = 0;
+	int i;
+	
+	/* chunk boundaries stay on command boundaries */
+	share = (datSz / jobs + STRIDE - 1) & ~(size_t)(STRIDE - 1);
+	if (!share)
+		share = STRIDE;
+	
+	if (!(chunk = calloc(jobs, sizeof(*chunk)))
+		|| !(thread = calloc(jobs, sizeof(*thread)))
+	)
+	{
+		free(chunk);
+		return -1;
+	}
+	
+	for (i = 0; i < jobs; ++i)
+	{
+		size_t begin = share * i;
+		size_t end = begin + share;
+		
+		if (begin > datSz)
+			begin = datSz;
+		if (end > datSz || i == jobs - 1)
+			end = datSz;
+		chunk[i].begin = datBegin + begin;
+		chunk[i].end = datBegin + end;
+	}
+	
+	/* this thread scans the first chunk */
+	for (started = 1; started < jobs; ++started)
+		if (pthread_create(thread + started, 0, scanchunk, chunk + started))
+			break;
+	scanchunk(chunk);
+	for (i = 1; i < started; ++i)
+		pthread_join(thread[i], 0);
+	for ( ; i < jobs; ++i)
+		scanchunk(chunk + i);
+	
+	for (i = 0; i < jobs; ++i)
+		fail |= chunk[i].fail;
+	
+	/* resolution, in address order */
+	start = statsNow();
+	scanInit(&s, datBegin, datSz, stdout);
+	s.scanned = datSz;
+	for (i = 0; i < jobs && !fail; ++i)
+	{
+		size_t k;
+		
+		for (k = 0; k < chunk[i].markerNum; ++k)
+		{
+			size_t dat = chunk[i].marker[k] - datBegin;
 			
-			/* no room list */
-			if (roomnum == 0)
+			/* skip markers claimed by an earlier match */
+			if (scanPeek(&s, dat) == 0x14)
+				scanCheck(&s, dat);
+			else
+			{
+				++s.markerNum;
+				++s.reject[SCAN_CLAIMED];
+			}
+		}
+	}
+	
+	scanStats(&s);
+	statsSpan("scan", start, "resolution");
+	claimsFree(&s.claims);
+	for (i = 0; i < jobs; ++i)
+		free(chunk[i].marker);
+	free(chunk);
+	free(thread);
+	
+	return fail;
+}
+
+/* modification time of a file, in nanoseconds */
+static int64_t mtime(const struct stat *st)
+{
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* loads the index kept beside a dump, building it if it is missing or
+ * if rebuild is set; if the dump's size, time, or first and last pages
+ * differ from when it was indexed, it is rehashed, and only reindexed
+ * if its contents did change, so the usual case reads just two pages
+ * returns 0 on success, non-zero on failure
+ */
+static int indexOpen(struct opindex *x, const char *fn, const uint8_t *dat, size_t datSz, int rebuild)
+{
+	struct stat st;
+	char *idx;
+	int rval = 0;
+	
+	if (stat(fn, &st) || !(idx = malloc(strlen(fn) + 5)))
+		return -1;
+	sprintf(idx, "%s.idx", fn);
+	
+	if (!rebuild && !opindexLoad(x, idx))
+	{
+		if (x->datSz == datSz
+			&& x->mtime == mtime(&st)
+			&& x->probe == opindexProbe(dat, datSz)
+		)
+			goto done;
+		if (x->datSz == datSz && x->hash == opindexHash(dat, datSz))
+		{
+			/* same contents, so only the recorded time is refreshed */
+			x->mtime = mtime(&st);
+			opindexSave(x, idx);
+			goto done;
+		}
+		opindexFree(x);
+	}
+	
+	if (opindexBuild(x, dat, datSz))
+	{
+		rval = -1;
+		goto done;
+	}
+	x->mtime = mtime(&st);
+	
+	/* the index is still usable even if it can't be kept */
+	if (opindexSave(x, idx))
+		fprintf(stderr, "failed to write '%s'\n", idx);
+
+done:
+	free(idx);
+	return rval;
+}
+
+/* answers a query from the index of a dump:
+ * "scenes" prints exactly what findheaders() would, reading only the
+ * parts of the dump near end markers
+ * "OP" prints the offset of every command with that opcode (in hex)
+ * "OP:SEG" prints only those whose second word is a segment SEG
+ * (0x02 or 0x03) pointer
+ * returns 0 on success, non-zero on failure
+ */
+static int indexQuery(const struct opindex *x, uint8_t *dat, size_t datSz, const char *spec)
+{
+	size_t *ofs;
+	size_t *seg = 0;
+	size_t ofsNum;
+	size_t segNum = 0;
+	size_t i;
+	size_t k;
+	unsigned long op;
+	unsigned long segment = 0;
+	char *next;
+	
+	if (!strcmp(spec, "scenes"))
+	{
+		struct scan s;
+		
+		if (!(ofs = opindexList(x, endmarker[0], &ofsNum)))
+			return -1;
+		
+		/* in address order, as the serial scan would */
+		scanInit(&s, dat, datSz, stdout);
+		for (i = 0; i < ofsNum; ++i)
+			if (!memcmp(dat + ofs[i], endmarker, STRIDE)
+				&& scanPeek(&s, ofs[i]) == 0x14
+			)
+				scanCheck(&s, ofs[i]);
+		claimsFree(&s.claims);
+		free(ofs);
+		
+		return 0;
+	}
+	
+	op = strtoul(spec, &next, 16);
+	if (*next == ':')
+		segment = strtoul(next + 1, &next, 16);
+	if (next == spec || *next
+		|| (segment && segment != 0x02 && segment != 0x03)
+	)
+		return -1;
+	
+	/* nothing else is indexed */
+	if (op >= OPINDEX_OPS)
+	{
+		fprintf(stderr, "only header commands (00-1F) are indexed\n");
+		return -1;
+	}
+	
+	if (!(ofs = opindexList(x, op, &ofsNum))
+		|| (segment && !(seg = opindexList(x, segment == 0x02 ? OPINDEX_SEG02 : OPINDEX_SEG03, &segNum)))
+	)
+	{
+		free(ofs);
+		return -1;
+	}
+	
+	/* both lists are sorted, so they are intersected in one pass */
+	for (i = k = 0; i < ofsNum; ++i)
+	{
+		if (segment)
+		{
+			while (k < segNum && seg[k] < ofs[i])
+				++k;
+			if (k == segNum || seg[k] != ofs[i])
 				continue;
+		}
+		fprintf(stdout, "%08X\n", (unsigned)ofs[i]);
+	}
+	
+	free(ofs);
+	free(seg);
+	
+	return 0;
+}
+
+/* sweeps a buffer once for every kind of structure and prints each
+ * candidate, tab-separated, in address order
+ * returns 0 on success, non-zero on failure
+ */
+int findstructures(uint8_t *datBegin, size_t datSz)
+{
+	struct candidates c = {0};
+	size_t i;
+	
+	if (sigscan(datBegin, datSz, &c))
+		return -1;
+	
+	fprintf(stdout, "#kind\toffset\tsize\tconfidence\tdetail\n");
+	for (i = 0; i < c.num; ++i)
+		fprintf(stdout, "%s\t%08X\t%u\t%d\t%u\n"
+			, sigscanKind(c.cand[i].kind)
+			, (unsigned)c.cand[i].ofs
+			, (unsigned)c.cand[i].sz
+			, c.cand[i].confidence
+			, c.cand[i].detail
+		);
+	
+	sigscanFree(&c);
+	
+	return 0;
+}
+
+/* fills a buffer with densely packed synthetic scenes, each of whose
+ * rooms is full of decoy headers, so claimed ranges are hit constantly
+ */
+static void densedump(uint8_t *buf, size_t sz)
+{
+	const size_t block = 0x2000;
+	size_t ofs;
+	
+	memset(buf, 0, sz);
+	for (ofs = 0; ofs + block <= sz; ofs += block)
+	{
+		uint8_t *b = buf + ofs;
+		size_t k;
+		int i;
+		
+		/* scene header: 0x15, 0x04 with four rooms, end marker */
+		b[0x00] = 0x15;
+		b[0x08] = 0x04;
+		b[0x09] = 4;
+		b[0x0c] = 0x02;
+		b[0x0f] = 0x40;
+		memcpy(b + 0x10, endmarker, STRIDE);
+		
+		for (i = 0; i < 4; ++i)
+		{
+			uint32_t begin = ofs + 0x200 + i * 0x700;
+			uint32_t end = begin + 0x700;
+			uint8_t *r = b + 0x40 + i * 8;
 			
-			/* invalid room list pointer */
-			if (!(roomlist = scenesegment(datBegin, datEnd, scene, roomlist)))
-				continue;
+			r[0] = begin >> 24; r[1] = begin >> 16; r[2] = begin >> 8; r[3] = begin;
+			r[4] = end >> 24; r[5] = end >> 16; r[6] = end >> 8; r[7] = end;
 			
-			/* print file address of potential scene header */
-			fprintf(stdout, "%08X\n", datAddr);
+			/* decoy headers throughout each room */
+			for (k = begin; k + 0x40 <= end; k += 0x40)
+			{
+				buf[k] = 0x18;
+				memcpy(buf + k + STRIDE, endmarker, STRIDE);
+			}
+		}
+	}
+}
+
+/* times every end marker kernel over a large synthetic buffer, which
+ * has a single marker at its very end; memchr() over the same buffer
+ * is a rough stand-in for the memory bandwidth ceiling
+ */
+static void benchmark(size_t mib)
+{
+	struct {
+		const char *name;
+		findmarker_t *func;
+	} kernel[4];
+	size_t sz = mib << 20;
+	uint8_t *buf;
+	uint32_t x = 0x2545f491;
+	const char *best;
+	int kernelNum = 0;
+	int i;
+	size_t k;
+	
+	if (!sz || !(buf = malloc(sz)))
+		die("failed to allocate benchmark buffer");
+	
+	/* pseudo-random bytes with decoy 0x14 opcodes, but no 0xff bytes */
+	for (k = 0; k < sz; ++k)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[k] = (k & 7) ? (x & 0x7f) : (x & 1) ? 0x14 : (x & 0x7f);
+	}
+	memcpy(buf + ((sz - STRIDE) & ~(STRIDE - 1)), endmarker, STRIDE);
+	
+	while (kernelNum < 4
+		&& (kernel[kernelNum].func = findmarkerKernel(kernelNum, &kernel[kernelNum].name))
+	)
+		++kernelNum;
+	findmarkerSelect(&best);
+	
+	fprintf(stdout, "scanning %u MiB, best of 5\n", (unsigned)mib);
+	for (i = -1; i < kernelNum; ++i)
+	{
+		double fastest = 0;
+		int run;
+		
+		for (run = 0; run < 5; ++run)
+		{
+			double start = now();
+			double elapsed;
 			
-			/* walk room list */
-			for (i = 0; i < roomnum; ++i)
+			if (i < 0)
 			{
-				uint8_t *this = roomlist + i * sizeof(uint32_t) * 2;
-				uint32_t begin = rbeu32(this);
-				uint32_t end = rbeu32(this + sizeof(uint32_t));
-				
-				/* invalid room address conditions */
-				if (begin > end
-					|| begin >= datSz
-					|| end >= datSz
-				)
-				{
-					fprintf(stdout, " -> ERROR\n");
-					break;
-				}
-				
-				/* list start address of each room referenced by scene */
-				fprintf(stdout, " -> %08X\n", begin);
-				
-				/* zero each room file's contents so its header is ignored */
-				memset(datBegin + begin, 0, end - begin);
-				
-				/* files are packed such that the end of the scene
-				 * happens to be the same address as the beginning
-				 * of the first room
-				 */
-				if (i == 0)
-					sceneEnd = datBegin + begin;
+				if (memchr(buf, 0xff, sz))
+					die("benchmark buffer is malformed");
 			}
+			else if (kernel[i].func(buf, buf + sz) != buf + sz - STRIDE)
+				die("kernel missed the end marker");
+			
+			elapsed = now() - start;
+			if (!run || elapsed < fastest)
+				fastest = elapsed;
+		}
+		
+		fprintf(stdout, "%-8s %6.2f GB/s%s\n"
+			, i < 0 ? "memchr" : kernel[i].name
+			, sz / fastest / 1e9
+			, (i >= 0 && !strcmp(kernel[i].name, best)) ? " (selected)" : ""
+		);
+	}
+	
+	/* claimed range lookups versus zeroing, on a dense dump */
+	fprintf(stdout, "claiming on a dense synthetic dump, best of 5\n");
+	densedump(buf, sz);
+	for (i = 0; i < 2; ++i)
+	{
+		double fastest = 0;
+		size_t found = 0;
+		int run;
+		
+		for (run = 0; run < 5; ++run)
+		{
+			struct scan s;
+			uint8_t *copy = buf;
+			double start;
+			double elapsed;
+			FILE *null;
+			
+			/* zeroing is destructive, so it gets a fresh copy */
+			if (i == 0 && (!(copy = malloc(sz)) || !memcpy(copy, buf, sz)))
+				die("failed to allocate benchmark buffer");
+			if (!(null = fopen("/dev/null", "w")))
+				die("failed to open /dev/null");
+			
+			scanInit(&s, copy, sz, null);
+			s.zero = (i == 0);
+			start = now();
+			scanAll(&s);
+			elapsed = now() - start;
+			found = s.sceneNum;
 			
-			/* it made it through the entire room list without a problem,
-			 * so that data appears to be correct; now zero the scene
-			 * file's contents in case it contains alternate headers
-			 */
-			if (i == roomnum)
-				memset(scene, 0, sceneEnd - scene);
+			claimsFree(&s.claims);
+			fclose(null);
+			if (copy != buf)
+				free(copy);
+			
+			if (!run || elapsed < fastest)
+				fastest = elapsed;
 		}
+		
+		fprintf(stdout, "%-8s %6.2f GB/s, %u scenes\n"
+			, i == 0 ? "memset" : "claims"
+			, sz / fastest / 1e9
+			, (unsigned)found
+		);
 	}
 	
-	#undef STRIDE
+	free(buf);
 }
 
 int main(int argc, char *argv[])
 {
 	uint8_t *dat;
 	size_t datSz;
-	const char *fn = argv[1];
+	const char *fn;
+	int huge = 0;
+	int mapped = 1;
+	int stream = 0;
+	int corpus = 0;
+	int indexed = 0;
+	int structures = 0;
+	const char *query = 0;
+	const char *trace = 0;
+	int stats = 0;
+	int jobs = 1;
+	double start;
+	
+	/* options */
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (!strcmp(argv[1], "--huge"))
+			huge = 1;
+		else if (!strcmp(argv[1], "--stream"))
+			stream = 1;
+		else if (!strcmp(argv[1], "--corpus"))
+			corpus = 1;
+		else if (!strcmp(argv[1], "--structures"))
+			structures = 1;
+		else if (!strcmp(argv[1], "--index"))
+			indexed = 1;
+		else if (!strcmp(argv[1], "--stats"))
+			stats = 1;
+		else if (!strcmp(argv[1], "--trace") && argc > 2)
+		{
+			trace = argv[2];
+			++argv;
+			--argc;
+		}
+		else if (!strcmp(argv[1], "--query") && argc > 2)
+		{
+			query = argv[2];
+			++argv;
+			--argc;
+		}
+		else if (!strcmp(argv[1], "-j") && argc > 2)
+		{
+			if ((jobs = atoi(argv[2])) < 1)
+				die("-j expects a positive number of threads");
+			++argv;
+			--argc;
+		}
+		else if (!strcmp(argv[1], "--bench"))
+		{
+			benchmark(argc > 2 ? strtoul(argv[2], 0, 0) : 512);
+			return 0;
+		}
+		else
+			break;
+		++argv;
+		--argc;
+	}
+	
+	fn = argv[1];
+	
+	/* where the time goes, printed to stderr or written as a trace */
+	statsBegin(stats, trace);
+	start = statsNow();
+	
+	/* many files or directories at once */
+	if (corpus && argc > 1)
+	{
+		if (findheadersCorpus(argv + 1, argc - 1, jobs))
+			die("failed to scan corpus");
+		statsSpan("stage", start, "corpus");
+		return statsEnd(stderr) ? EXIT_FAILURE : 0;
+	}
 	
 	if (argc != 2 || !fn)
-		die("arguments: find-scenes file.bin");
+		die("arguments: find-scenes [--huge | --stream] [-j N] [--stats] [--trace out.json] file.bin\n"
+			"       find-scenes --structures file.bin\n"
+			"       find-scenes --corpus [-j N] [--stats] [--trace out.json] file-or-dir...\n"
+			"       find-scenes --index file.bin\n"
+			"       find-scenes --query scenes|OP|OP:SEG file.bin\n"
+			"       find-scenes --bench [MiB]"
+		);
 	
-	if (!(dat = loadfile(fn, &datSz)))
-		die("failed to load input file");
+	/* bounded memory, for inputs too large to load */
+	if (stream)
+	{
+		int fd = open(fn, O_RDONLY);
+		
+		if (fd < 0)
+			die("failed to open input file");
+		if (findheadersStream(fd))
+			die("failed to read input file");
+		close(fd);
+		statsSpan("stage", start, "scan");
+		return statsEnd(stderr) ? EXIT_FAILURE : 0;
+	}
 	
-	findheaders(dat, datSz);
+	/* fall back to reading the file if it can't be mapped */
+	if (!(dat = mapfile(fn, &datSz, huge)))
+	{
+		mapped = 0;
+		if (!(dat = loadfile(fn, &datSz)))
+			die("failed to load input file");
+	}
+	
+	/* every kind of structure, not just scenes */
+	if (structures)
+	{
+		if (findstructures(dat, datSz))
+			die("failed to scan input file");
+	}
+	/* answered from, or just (re)building, the index beside the file */
+	else if (indexed || query)
+	{
+		struct opindex x;
+		
+		if (indexOpen(&x, fn, dat, datSz, indexed))
+			die("failed to index input file");
+		if (query && indexQuery(&x, dat, datSz, query))
+			die("invalid query");
+		opindexFree(&x);
+	}
+	else if (jobs > 1)
+	{
+		if (findheadersParallel(dat, datSz, jobs))
+			die("failed to scan input file");
+	}
+	else
+		findheaders(dat, datSz);
+	statsSpan("stage", start, "scan");
 	
 	/* cleanup */
-	free(dat);
-	return 0;
+	if (mapped)
+		munmap(dat, datSz);
+	else
+		free(dat);
+	return statsEnd(stderr) ? EXIT_FAILURE : 0;
 }
-
@@ -0,0 +1,369 @@
+/*
+ * fuzz-room.c <z64.me>
+ *
+ * feeds malformed rooms to roomconv() in-process, thousands a second;
+ * built with clang -fsanitize=fuzzer -DFUZZ_LIBFUZZER it is a libFuzzer
+ * target, and otherwise it mutates a corpus of rooms on its own
+ *
+ */
+
+#define _GNU_SOURCE /* nftw() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "roomconv.h"
+#include "ucode.h"
+
+/* libFuzzer entry point; each input is a room of exactly that size,
+ * so a sanitizer sees any read or write past the end of it, and it is
+ * optimized too, so every pass runs on it
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint8_t *room;
+	
+	if (!size || !(room = malloc(size)))
+		return 0;
+	
+	memcpy(room, data, size);
+	roomconv(room, size, ROOMCONV_OPTIMIZE);
+	free(room);
+	
+	return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define die(X) { fprintf(stderr, X"\n"); exit(EXIT_FAILURE); }
+
+/* largest input mutations may grow to */
+#define INPUT_MAX (1 << 20)
+
+/* one input of the corpus */
+struct input {
+	uint8_t *dat;
+	size_t sz;
+};
+
+static struct input *gInput = 0;
+static size_t gInputNum = 0;
+static size_t gInputCap = 0;
+
+/* what is being run right now, saved if it crashes or hangs */
+static uint8_t gCurrent[INPUT_MAX];
+static size_t gCurrentSz = 0;
+static const char *gCrashDir = ".";
+static int gReport = STDERR_FILENO;
+
+/* the generator; everything depends only on the seed */
+static uint64_t gSeed = 1;
+
+/* xorshift64* */
+static uint32_t rnd(void)
+{
+	gSeed ^= gSeed >> 12;
+	gSeed ^= gSeed << 25;
+	gSeed ^= gSeed >> 27;
+	
+	return (gSeed * 0x2545f4914f6cdd1d) >> 32;
+}
+
+/* write u32 as big-endian bytes */
+static inline void wbeU32(uint8_t *b, uint32_t v)
+{
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* monotonic time in seconds */
+static double now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* write() whose result is of no use; nothing can be done about it */
+static void put(int fd, const void *buf, size_t len)
+{
+	if (write(fd, buf, len) < 0)
+		return;
+}
+
+/* saves the input that was running and exits; only async-signal-safe
+ * calls are made, which rules out stdio
+ */
+static void onSignal(int sig)
+{
+	const char *kind = sig == SIGALRM ? "timeout" : "crash";
+	char fn[4096];
+	size_t len = strlen(gCrashDir);
+	int fd;
+	
+	if (len + 32 < sizeof(fn))
+	{
+		memcpy(fn, gCrashDir, len);
+		fn[len] = '/';
+		strcpy(fn + len + 1, kind);
+		strcat(fn, "-input.bin");
+		if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0)
+		{
+			put(fd, gCurrent, gCurrentSz);
+			close(fd);
+		}
+		put(gReport, kind, strlen(kind));
+		put(gReport, ": input saved to ", 17);
+		put(gReport, fn, strlen(fn));
+		put(gReport, "\n", 1);
+	}
+	
+	_exit(EXIT_FAILURE);
+}
+
+/* nftw() callback; adds a file to the corpus */
+static int addOne(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	FILE *fp;
+	uint8_t *dat;
+	
+	(void)ftw;
+	
+	if (type != FTW_F || st->st_size <= 0 || st->st_size > INPUT_MAX)
+		return 0;
+	
+	if (gInputNum == gInputCap)
+	{
+		size_t cap = gInputCap ? gInputCap * 2 : 64;
+		void *tmp = realloc(gInput, cap * sizeof(*gInput));
+		
+		if (!tmp)
+			return -1;
+		gInput = tmp;
+		gInputCap = cap;
+	}
+	
+	if (!(dat = malloc(st->st_size)))
+		return -1;
+	if (!(fp = fopen(path, "rb"))
+		|| fread(dat, 1, st->st_size, fp) != (size_t)st->st_size
+	)
+	{
+		if (fp)
+			fclose(fp);
+		free(dat);
+		return 0;
+	}
+	fclose(fp);
+	
+	gInput[gInputNum].dat = dat;
+	gInput[gInputNum].sz = st->st_size;
+	++gInputNum;
+	
+	return 0;
+}
+
+/* runs whatever is in gCurrent, as libFuzzer would */
+static void runCurrent(unsigned timeout)
+{
+	alarm(timeout);
+	LLVMFuzzerTestOneInput(gCurrent, gCurrentSz);
+}
+
+/* applies a few random changes to gCurrent, aimed at the things the
+ * walkers trust: opcodes, segment pointers, counts, and the size
+ */
+static void mutate(void)
+{
+	unsigned n = 1 + rnd() % 4;
+	
+	while (n--)
+	{
+		size_t sz = gCurrentSz;
+		size_t at = rnd() % sz;
+		size_t cmd = at & ~(size_t)7;
+		
+		switch (rnd() % 8)
+		{
+			/* flip a bit */
+			case 0:
+				gCurrent[at] ^= 1 << (rnd() % 8);
+				break;
+			
+			/* any byte */
+			case 1:
+				gCurrent[at] = rnd();
+				break;
+			
+			/* an opcode either microcode might have */
+			case 2:
+				if (cmd + 8 <= sz)
+					gCurrent[cmd] = (uint8_t[]){
+						0x00, 0x01, 0x03, 0x04, 0x06, 0x0a, 0x14, 0x18
+						, 0xb1, 0xb5, 0xb8, 0xbf, 0xde, 0xdf, 0xe7, 0xfd
+					}[rnd() % 16];
+				break;
+			
+			/* a segment pointer, anywhere in the room or past it */
+			case 3:
+				if (cmd + 8 <= sz)
+					wbeU32(gCurrent + cmd + 4, 0x03000000 | (rnd() % (sz * 2) & ~7));
+				break;
+			
+			/* an interesting word */
+			case 4:
+				if (at + 4 <= sz)
+					wbeU32(gCurrent + at, (uint32_t[]){
+						0, 0xffffffff, 0x03ffffff, 0x03000000, 0xb8000000, 0x14000000
+					}[rnd() % 6]);
+				break;
+			
+			/* a command copied from elsewhere */
+			case 5:
+			{
+				size_t from = rnd() % sz & ~(size_t)7;
+				
+				if (cmd + 8 <= sz && from + 8 <= sz)
+					memmove(gCurrent + cmd, gCurrent + from, 8);
+				break;
+			}
+			
+			/* truncated */
+			case 6:
+				if (sz > 8)
+					gCurrentSz = 1 + rnd() % (sz - 1);
+				break;
+			
+			/* grown, with another input spliced onto the end */
+			case 7:
+			{
+				struct input *in = gInput + rnd() % gInputNum;
+				size_t len = in->sz;
+				
+				if (sz + len > INPUT_MAX)
+					len = INPUT_MAX - sz;
+				memcpy(gCurrent + sz, in->dat, len);
+				gCurrentSz = sz + len;
+				break;
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long runs = 100000;
+	unsigned long i;
+	unsigned timeout = 5;
+	double start;
+	int null;
+	int k;
+	
+	/* options */
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (!strcmp(argv[1], "-n"))
+			runs = strtoul(argv[2], 0, 0);
+		else if (!strcmp(argv[1], "-s"))
+			gSeed = strtoull(argv[2], 0, 0) | 1;
+		else if (!strcmp(argv[1], "-t"))
+			timeout = strtoul(argv[2], 0, 0);
+		else if (!strcmp(argv[1], "-o"))
+			gCrashDir = argv[2];
+		else if (!strcmp(argv[1], "-u"))
+		{
+			if (roomconvUcode(argv[2]))
+			{
+				fprintf(stderr, "unsupported microcode pair '%s'; try one of: %s\n"
+					, argv[2], ucodePairList()
+				);
+				return EXIT_FAILURE;
+			}
+		}
+		else
+			break;
+		argv += 2;
+		argc -= 2;
+	}
+	
+	if (argc < 2 || argv[1][0] == '-' || !timeout)
+		die("arguments: fuzz-room [-n runs] [-s seed] [-t seconds] [-o crash-dir] [-u from:to] room-or-dir...");
+	
+	for (k = 1; k < argc; ++k)
+		if (nftw(argv[k], addOne, 16, FTW_PHYS))
+			die("failed to read corpus");
+	if (!gInputNum)
+		die("the corpus is empty");
+	
+	/* roomconv() explains every bad room on stderr; that's just noise here */
+	if ((gReport = dup(STDERR_FILENO)) < 0
+		|| (null = open("/dev/null", O_WRONLY)) < 0
+		|| dup2(null, STDERR_FILENO) < 0
+	)
+		die("failed to silence stderr");
+	close(null);
+	
+	signal(SIGSEGV, onSignal);
+	signal(SIGBUS, onSignal);
+	signal(SIGABRT, onSignal);
+	signal(SIGFPE, onSignal);
+	signal(SIGILL, onSignal);
+	signal(SIGALRM, onSignal);
+	
+	start = now();
+	
+	/* the corpus as it is, then mutations of it */
+	for (i = 0; i < gInputNum; ++i)
+	{
+		memcpy(gCurrent, gInput[i].dat, gInput[i].sz);
+		gCurrentSz = gInput[i].sz;
+		runCurrent(timeout);
+	}
+	for (i = 0; i < runs; ++i)
+	{
+		struct input *in = gInput + rnd() % gInputNum;
+		
+		memcpy(gCurrent, in->dat, in->sz);
+		gCurrentSz = in->sz;
+		mutate();
+		runCurrent(timeout);
+	}
+	alarm(0);
+	
+	{
+		double elapsed = now() - start;
+		FILE *fp = fdopen(gReport, "w");
+		
+		if (fp)
+		{
+			fprintf(fp, "%lu inputs, %lu mutations, %.2f seconds, %.0f/s\n"
+				, (unsigned long)gInputNum
+				, runs
+				, elapsed
+				, elapsed > 0 ? (gInputNum + runs) / elapsed : 0
+			);
+			fclose(fp);
+		}
+	}
+	
+	for (i = 0; i < gInputNum; ++i)
+		free(gInput[i].dat);
+	free(gInput);
+	
+	return 0;
+}
+
+#endif /* FUZZ_LIBFUZZER */
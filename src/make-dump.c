@@ -0,0 +1,508 @@
+/*
+ * make-dump.c <z64.me>
+ *
+ * generates synthetic overdumps for benchmarking, with scenes and
+ * rooms laid out like the real thing, amid noise and decoy headers
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define die(X) { fprintf(stderr, X"\n"); exit(EXIT_FAILURE); }
+
+#define ROOM_MAX  8   /* rooms per scene */
+#define DOOR_MAX  8   /* doors per scene */
+#define VTX_MAX   32  /* vertices per load, the f3dex limit */
+#define SHARED    4   /* display lists shared by every mesh in a room */
+
+/* the generator; everything depends only on the seed */
+static uint64_t gSeed = 1;
+
+/* xorshift64* */
+static uint32_t rnd(void)
+{
+	gSeed ^= gSeed >> 12;
+	gSeed ^= gSeed << 25;
+	gSeed ^= gSeed >> 27;
+	
+	return (gSeed * 0x2545f4914f6cdd1d) >> 32;
+}
+
+/* random number in [lo, hi] */
+static uint32_t range(uint32_t lo, uint32_t hi)
+{
+	return lo + rnd() % (hi - lo + 1);
+}
+
+/* write u32 as big-endian bytes */
+static inline void wbeU32(uint8_t *b, uint32_t v)
+{
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* write a command or any other pair of words */
+static inline void put(uint8_t *b, uint32_t w0, uint32_t w1)
+{
+	wbeU32(b, w0);
+	wbeU32(b + 4, w1);
+}
+
+/* minimal file writer
+ * returns 0 on failure
+ * returns non-zero on success
+ */
+int savefile(const char *fn, const void *dat, const size_t sz)
+{
+	FILE *fp;
+	
+	/* rudimentary error checking returns 0 on any error */
+	if (
+		!fn
+		|| !sz
+		|| !dat
+		|| !(fp = fopen(fn, "wb"))
+		|| fwrite(dat, 1, sz, fp) != sz
+		|| fclose(fp)
+	)
+		return 0;
+	
+	return 1;
+}
+
+/* compressed-looking filler; commands that could begin or end a scene
+ * header never start an aligned word, so the only headers in the dump
+ * are the ones put there on purpose
+ */
+static void noise(uint8_t *b, size_t sz)
+{
+	size_t i;
+	
+	for (i = 0; i + 4 <= sz; i += 4)
+		wbeU32(b + i, rnd());
+	
+	for (i = 0; i < sz; i += 8)
+		if (b[i] == 0x14 || b[i] == 0x15 || b[i] == 0x18 || b[i] == 0x04)
+			b[i] ^= 0x40;
+}
+
+/* a room being generated; offsets are within the room */
+struct room {
+	uint8_t *b;
+	unsigned sz;            /* bytes allotted to it */
+	unsigned used;          /* bytes allocated so far */
+	unsigned vtx;           /* start of its vertex buffer */
+	unsigned vtxNum;
+	unsigned shared[SHARED]; /* nested lists, called by the others */
+};
+
+/* allocates sz bytes of a room, 8-byte aligned */
+static unsigned alloc(struct room *r, unsigned sz)
+{
+	unsigned ofs = r->used;
+	
+	r->used += (sz + 7) & ~7;
+	
+	return ofs;
+}
+
+/* a display list of cmdNum commands, ending in G_ENDDL; any list in
+ * shared with an index below depth may be called, which is how the
+ * shared lists nest within each other
+ */
+static unsigned dlist(struct room *r, unsigned cmdNum, int depth)
+{
+	unsigned ofs = alloc(r, (cmdNum + 1) * 8);
+	uint8_t *b = r->b + ofs;
+	uint8_t *end = b + cmdNum * 8;
+	
+	/* rdp state, then rsp state, as exported by most tools */
+	put(b, 0xe7000000, 0); /* G_RDPPIPESYNC */
+	put(b + 8, 0xfc127e24, 0xfffff9fc); /* G_SETCOMBINE */
+	put(b + 16, 0xb6000000, 0x00002000); /* G_CLEARGEOMETRYMODE */
+	put(b + 24, 0xb7000000, 0x00000200 | (rnd() & 0x00001000)); /* G_SETGEOMETRYMODE */
+	b += 32;
+	
+	while (b + 8 <= end)
+	{
+		unsigned n = range(3, VTX_MAX);
+		unsigned v = range(0, r->vtxNum - n);
+		unsigned pick = rnd() % 16;
+		
+		/* the usual: load vertices, then draw triangles with them */
+		if (pick < 10 && b + 16 <= end)
+		{
+			put(b, 0x04000000 | n << 10 | (n * 16 - 1), 0x03000000 | (r->vtx + v * 16));
+			b += 8;
+			while (b + 8 <= end && rnd() % 8)
+			{
+				unsigned a = range(0, n - 1) * 2;
+				unsigned c = range(0, n - 1) * 2;
+				unsigned d = range(0, n - 1) * 2;
+				unsigned e = range(0, n - 1) * 2;
+				
+				switch (rnd() % 3)
+				{
+					case 0: /* G_TRI1 */
+						put(b, 0xbf000000, a << 16 | c << 8 | d);
+						break;
+					
+					case 1: /* G_TRI2 */
+						put(b, 0xb1000000 | a << 16 | c << 8 | d, d << 16 | e << 8 | a);
+						break;
+					
+					case 2: /* G_QUAD */
+						put(b, 0xb5000000 | a << 16 | c << 8 | d, a << 16 | d << 8 | e);
+						break;
+				}
+				b += 8;
+			}
+		}
+		/* call a nested list */
+		else if (pick < 12 && depth)
+		{
+			put(b, 0x06000000, 0x03000000 | r->shared[rnd() % depth]);
+			b += 8;
+		}
+		/* an animated texture, which is disabled during conversion */
+		else if (pick < 13)
+		{
+			put(b, 0x06000000, 0x08000000);
+			b += 8;
+		}
+		/* mode changes */
+		else if (pick < 14)
+		{
+			put(b, 0xba001402, 0x00100000); /* G_SETOTHERMODE_H */
+			b += 8;
+		}
+		else if (pick < 15)
+		{
+			put(b, 0xbb000001, 0xffffffff); /* G_TEXTURE */
+			b += 8;
+		}
+		else if (rnd() % 4)
+		{
+			put(b, 0xfa000000, rnd()); /* G_SETPRIMCOLOR */
+			b += 8;
+		}
+		/* a tagged no-op, as some exporters leave behind */
+		else
+		{
+			put(b, 0xc0000000, rnd()); /* G_NOOP */
+			b += 8;
+		}
+	}
+	
+	put(end, 0xb8000000, 0); /* G_ENDDL */
+	
+	return ofs;
+}
+
+/* writes a room of the given size at b; its display lists are hung off
+ * a mesh header of the given type (0, 1, or 2)
+ */
+static void room(uint8_t *b, unsigned sz, int type)
+{
+	struct room r = {0};
+	unsigned entryNum = range(1, 6);
+	unsigned avail;
+	unsigned fixed;
+	unsigned cmdNum;
+	unsigned mesh;
+	unsigned entry;
+	unsigned list;
+	unsigned actor;
+	unsigned object;
+	unsigned i;
+	
+	memset(b, 0, sz);
+	r.b = b;
+	r.sz = sz;
+	
+	/* header */
+	alloc(&r, 8 * 8);
+	mesh = alloc(&r, 16);
+	entry = alloc(&r, entryNum * 16 + 8);
+	actor = alloc(&r, 4 * 16);
+	object = alloc(&r, 8 * 2);
+	put(b +  0, 0x18000000, 0x03000000 | object); /* alternate headers */
+	put(b +  8, 0x08000000, 0x00000001); /* room behavior */
+	put(b + 16, 0x01040000, 0x03000000 | actor);
+	put(b + 24, 0x0b080000, 0x03000000 | object);
+	put(b + 32, 0x0a000000, 0x03000000 | mesh);
+	put(b + 40, 0x14000000, 0);
+	for (i = 0; i < 4 * 16; i += 4)
+		wbeU32(b + actor + i, rnd());
+	
+	/* vertices take up about a tenth of the room */
+	r.vtxNum = sz / 10 / 16;
+	if (r.vtxNum < VTX_MAX)
+		r.vtxNum = VTX_MAX;
+	r.vtx = alloc(&r, r.vtxNum * 16);
+	for (i = 0; i < r.vtxNum * 16; i += 4)
+		wbeU32(b + r.vtx + i, rnd());
+	
+	/* the rest of the room is display lists; each shared and xlu list
+	 * gets cmdNum / 2 + 6 commands, each opa list cmdNum + 6
+	 */
+	avail = (sz - r.used) / 8;
+	fixed = 6 * SHARED + 12 * entryNum;
+	if (avail < fixed + SHARED + 3 * entryNum)
+		die("room too small");
+	cmdNum = 2 * (avail - fixed) / (SHARED + 3 * entryNum);
+	for (i = 0; i < SHARED; ++i)
+		r.shared[i] = dlist(&r, cmdNum / 2 + 5, i);
+	
+	for (i = 0; i < entryNum; ++i)
+	{
+		unsigned opa = dlist(&r, cmdNum + 5, SHARED);
+		unsigned xlu = rnd() % 2 ? 0x03000000 | dlist(&r, cmdNum / 2 + 5, SHARED) : 0;
+		
+		opa |= 0x03000000;
+		switch (type)
+		{
+			case 0:
+				put(b + entry + i * 8, opa, xlu);
+				break;
+			
+			case 1:
+				wbeU32(b + entry + i * 4, opa);
+				break;
+			
+			case 2:
+				put(b + entry + i * 16, rnd(), rnd() & 0x7fff);
+				put(b + entry + i * 16 + 8, opa, xlu);
+				break;
+		}
+	}
+	
+	/* mesh header */
+	list = 0x03000000 | entry;
+	if (type == 0)
+	{
+		put(b + mesh, entryNum << 16, list);
+		wbeU32(b + mesh + 8, list + entryNum * 8);
+	}
+	else if (type == 1)
+		put(b + mesh, 0x01010000, list);
+	else
+	{
+		put(b + mesh, 0x02000000 | entryNum << 16, list);
+		wbeU32(b + mesh + 8, list + entryNum * 16);
+	}
+	
+	if (r.used > sz)
+		die("room too small");
+}
+
+/* a scene being generated */
+struct scene {
+	unsigned ofs;
+	unsigned sz;            /* scene and rooms */
+	int doorStride;         /* 14 or 16 */
+};
+
+/* writes a scene and its rooms at dat + s->ofs, and writes each room
+ * to dir if non-zero
+ * returns number of rooms written
+ */
+static unsigned scene(uint8_t *dat, const struct scene *s, const char *dir, unsigned roomBase)
+{
+	uint8_t *b = dat + s->ofs;
+	unsigned roomNum = range(1, ROOM_MAX);
+	unsigned doorNum = range(0, DOOR_MAX);
+	unsigned roomSz;
+	unsigned roomOfs;
+	unsigned sceneSz;
+	unsigned i;
+	
+	/* the header is followed by room list, doors, collision, Link,
+	 * then filler standing in for everything else a scene has
+	 */
+	sceneSz = 0x200 + range(0, s->sz / 64) * 8;
+	noise(b, sceneSz);
+	memset(b, 0, 0x160);
+	
+	i = 0;
+	put(b + i, 0x15000000, 0x00000013); /* sound settings */
+	i += 8;
+	if (rnd() % 2)
+	{
+		put(b + i, 0x18000000, 0x02000150); /* alternate headers */
+		i += 8;
+	}
+	put(b + i, 0x04000000 | roomNum << 16, 0x02000040);
+	i += 8;
+	if (doorNum)
+	{
+		put(b + i, 0x0e000000 | doorNum << 16, 0x02000080);
+		i += 8;
+	}
+	put(b + i, 0x03000000, 0x02000100);
+	i += 8;
+	put(b + i, 0x00010000, 0x02000140);
+	i += 8;
+	put(b + i, 0x14000000, 0);
+	
+	/* doors */
+	for (i = 0; i < doorNum * s->doorStride; ++i)
+		b[0x80 + i] = rnd();
+	
+	/* collision header, with cameras and water boxes to be disabled */
+	for (i = 0; i < 0x20; i += 4)
+		wbeU32(b + 0x100 + i, rnd());
+	wbeU32(b + 0x120, 0x02000150);
+	wbeU32(b + 0x124, 1);
+	wbeU32(b + 0x128, 0x02000150);
+	
+	/* Link, sometimes with the broken variable that gets fixed */
+	put(b + 0x140, 0, rnd());
+	put(b + 0x148, rnd(), rnd() % 2 ? 0x000000ff : 0x00000fff);
+	
+	/* rooms split what's left, each a multiple of 16 bytes */
+	roomSz = ((s->sz - sceneSz) / roomNum) & ~15;
+	roomOfs = s->ofs + sceneSz;
+	for (i = 0; i < roomNum; ++i, roomOfs += roomSz)
+	{
+		char fn[1024];
+		
+		room(dat + roomOfs, roomSz, rnd() % 3);
+		put(b + 0x40 + i * 8, roomOfs, roomOfs + roomSz);
+		
+		if (dir)
+		{
+			sprintf(fn, "%s/room_%u.zmap", dir, roomBase + i);
+			if (!savefile(fn, dat + roomOfs, roomSz))
+				die("failed to write room");
+		}
+	}
+	
+	return roomNum;
+}
+
+/* headers that look like scenes until looked at closely; find-scenes
+ * sees some of them, but none have rooms extract-scenes would rip
+ */
+static void decoy(uint8_t *b, unsigned ofs)
+{
+	switch (rnd() % 5)
+	{
+		case 0: /* lone end marker */
+			put(b + 24, 0x14000000, 0);
+			break;
+		
+		case 1: /* not 16-byte aligned */
+			put(b + 8, 0x15000000, 0);
+			put(b + 16, 0x04010000, 0x02000040);
+			put(b + 24, 0x14000000, 0);
+			break;
+		
+		case 2: /* empty room list */
+			put(b, 0x15000000, 0);
+			put(b + 8, 0x04000000, 0x02000040);
+			put(b + 24, 0x14000000, 0);
+			break;
+		
+		case 3: /* room list outside of the scene's segment */
+			put(b, 0x15000000, 0);
+			put(b + 8, 0x04010000, 0x05000040);
+			put(b + 24, 0x14000000, 0);
+			break;
+		
+		case 4: /* room list with a backwards room */
+			put(b, 0x15000000, 0);
+			put(b + 8, 0x04010000, 0x02000040);
+			put(b + 24, 0x14000000, 0);
+			put(b + 64, ofs + 0x1000, ofs + 0x800);
+			break;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct scene *list;
+	uint8_t *dat;
+	size_t datSz = 32;
+	unsigned sceneNum = 48;
+	unsigned roomNum = 0;
+	unsigned slot;
+	unsigned i;
+	const char *manifest = 0;
+	const char *rooms = 0;
+	FILE *fp = 0;
+	
+	/* options */
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (!strcmp(argv[1], "-s"))
+			gSeed = strtoull(argv[2], 0, 0) | 1;
+		else if (!strcmp(argv[1], "-z"))
+			datSz = strtoul(argv[2], 0, 0);
+		else if (!strcmp(argv[1], "-n"))
+			sceneNum = strtoul(argv[2], 0, 0);
+		else if (!strcmp(argv[1], "-m"))
+			manifest = argv[2];
+		else if (!strcmp(argv[1], "-r"))
+			rooms = argv[2];
+		else
+			break;
+		argv += 2;
+		argc -= 2;
+	}
+	
+	if (argc != 2)
+		die("arguments: make-dump [-s seed] [-z MiB] [-n scenes] [-m scenes.tsv] [-r room-dir] out.z64");
+	
+	/* segment addresses are 24 bits, and rooms are absolute 32-bit */
+	datSz <<= 20;
+	if (!sceneNum || datSz / sceneNum < 0x40000 || datSz > 0xffffffff)
+		die("each scene needs at least 256 KiB, and dumps stop at 4 GiB");
+	slot = datSz / sceneNum;
+	
+	if (!(dat = malloc(datSz)) || !(list = calloc(sceneNum, sizeof(*list))))
+		die("out of memory");
+	noise(dat, datSz);
+	
+	if (manifest && !(fp = fopen(manifest, "w")))
+		die("failed to write manifest");
+	if (fp)
+		fprintf(fp, "# synthetic overdump made by make-dump\n");
+	
+	/* each scene gets a slot, about half of which it fills; the other
+	 * half is noise with a decoy every 64 KiB
+	 */
+	for (i = 0; i < sceneNum; ++i)
+	{
+		struct scene *s = list + i;
+		unsigned ofs;
+		
+		s->ofs = (i * slot + range(0, slot / 8)) & ~15;
+		s->sz = range(slot / 4, slot / 2) & ~15;
+		s->doorStride = i % 3 ? 16 : 14;
+		roomNum += scene(dat, s, rooms, roomNum);
+		
+		for (ofs = s->ofs + s->sz + 0x1000; ofs + 0x1000 < (i + 1) * slot; ofs += 0x10000)
+			decoy(dat + ofs, ofs);
+		
+		if (fp)
+			fprintf(fp, "%08X\t%s\tsynthetic %u\n", s->ofs, s->doorStride == 16 ? "-" : "0E", i);
+	}
+	
+	if (fp && fclose(fp))
+		die("failed to write manifest");
+	
+	if (!savefile(argv[1], dat, datSz))
+		die("failed to write dump");
+	
+	fprintf(stderr, "%u scenes, %u rooms, %u MiB\n", sceneNum, roomNum, (unsigned)(datSz >> 20));
+	
+	free(list);
+	free(dat);
+	return 0;
+}
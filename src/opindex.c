@@ -0,0 +1,301 @@
+/*
+ * opindex.c <z64.me>
+ *
+ * on-disk index of where each command opcode and segment pointer
+ * appears in a dump, so repeated queries needn't rescan it
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opindex.h"
+
+#define STRIDE 8 /* length of a command */
+#define PAGE 4096 /* bytes opindexProbe() reads from each end */
+
+/* identifies the file format */
+static const uint8_t magic[8] = { 'O', 'P', 'I', 'X', 0, 0, 0, 2 };
+
+/* little-endian u64 */
+static void wleu64(uint8_t *b, uint64_t v)
+{
+	int i;
+	
+	for (i = 0; i < 8; ++i)
+		b[i] = v >> (i * 8);
+}
+
+static uint64_t rleu64(const uint8_t *b)
+{
+	uint64_t v = 0;
+	int i;
+	
+	for (i = 0; i < 8; ++i)
+		v |= (uint64_t)b[i] << (i * 8);
+	
+	return v;
+}
+
+/* fnv-1a over 64-bit little-endian words, then any trailing bytes */
+uint64_t opindexHash(const uint8_t *dat, size_t datSz)
+{
+	const uint64_t prime = 0x100000001b3;
+	uint64_t h = 0xcbf29ce484222325;
+	size_t i;
+	
+	for (i = 0; i + 8 <= datSz; i += 8)
+	{
+		uint64_t w;
+		
+		memcpy(&w, dat + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		w = __builtin_bswap64(w);
+#endif
+		h = (h ^ w) * prime;
+	}
+	for ( ; i < datSz; ++i)
+		h = (h ^ dat[i]) * prime;
+	
+	return h ^ datSz;
+}
+
+uint64_t opindexProbe(const uint8_t *dat, size_t datSz)
+{
+	size_t sz = datSz < PAGE ? datSz : PAGE;
+	
+	return opindexHash(dat, sz) * 31 + opindexHash(dat + datSz - sz, sz);
+}
+
+/* appends command number cmd to a list, as a varint delta */
+static int append(struct opindex *x, int which, size_t cmd)
+{
+	size_t delta = x->list[which].num ? cmd - x->list[which].last : cmd;
+	
+	/* a varint is at most 10 bytes */
+	if (x->list[which].datSz + 10 > x->list[which].datCap)
+	{
+		size_t cap = x->list[which].datCap ? x->list[which].datCap * 2 : 256;
+		void *tmp = realloc(x->list[which].dat, cap);
+		
+		if (!tmp)
+			return -1;
+		x->list[which].dat = tmp;
+		x->list[which].datCap = cap;
+	}
+	
+	do
+	{
+		uint8_t b = delta & 0x7f;
+		
+		delta >>= 7;
+		x->list[which].dat[x->list[which].datSz++] = b | (delta ? 0x80 : 0);
+	} while (delta);
+	
+	x->list[which].last = cmd;
+	++x->list[which].num;
+	
+	return 0;
+}
+
+int opindexBuild(struct opindex *x, const uint8_t *dat, size_t datSz)
+{
+	size_t i;
+	
+	memset(x, 0, sizeof(*x));
+	x->datSz = datSz;
+	x->hash = opindexHash(dat, datSz);
+	x->probe = opindexProbe(dat, datSz);
+	
+	for (i = 0; i + STRIDE <= datSz; i += STRIDE)
+	{
+		const uint8_t *b = dat + i;
+		
+		/* padding, or not a header command, so no query can want it */
+		if (b[0] >= OPINDEX_OPS
+			|| !(b[0] | b[1] | b[2] | b[3] | b[4] | b[5] | b[6] | b[7])
+		)
+			continue;
+		
+		if (append(x, b[0], i / STRIDE)
+			|| (b[4] == 0x02 && append(x, OPINDEX_SEG02, i / STRIDE))
+			|| (b[4] == 0x03 && append(x, OPINDEX_SEG03, i / STRIDE))
+		)
+		{
+			opindexFree(x);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+int opindexSave(const struct opindex *x, const char *fn)
+{
+	uint8_t head[sizeof(magic) + 4 * 8 + OPINDEX_LISTS * 2 * 8];
+	uint8_t *b = head;
+	char *tmp;
+	FILE *fp;
+	int fail;
+	int i;
+	
+	memcpy(b, magic, sizeof(magic));
+	b += sizeof(magic);
+	wleu64(b, x->datSz); b += 8;
+	wleu64(b, x->mtime); b += 8;
+	wleu64(b, x->hash); b += 8;
+	wleu64(b, x->probe); b += 8;
+	for (i = 0; i < OPINDEX_LISTS; ++i)
+	{
+		wleu64(b, x->list[i].num); b += 8;
+		wleu64(b, x->list[i].datSz); b += 8;
+	}
+	
+	/* written alongside, so an interrupted save leaves the old index */
+	if (!(tmp = malloc(strlen(fn) + 5)))
+		return -1;
+	sprintf(tmp, "%s.tmp", fn);
+	if (!(fp = fopen(tmp, "wb")))
+	{
+		free(tmp);
+		return -1;
+	}
+	
+	fail = fwrite(head, 1, sizeof(head), fp) != sizeof(head);
+	for (i = 0; i < OPINDEX_LISTS && !fail; ++i)
+		if (x->list[i].datSz)
+			fail = fwrite(x->list[i].dat, 1, x->list[i].datSz, fp) != x->list[i].datSz;
+	fail |= fclose(fp) != 0;
+	
+	if (fail || rename(tmp, fn))
+	{
+		remove(tmp);
+		fail = 1;
+	}
+	free(tmp);
+	
+	return fail ? -1 : 0;
+}
+
+int opindexLoad(struct opindex *x, const char *fn)
+{
+	uint8_t head[sizeof(magic) + 4 * 8 + OPINDEX_LISTS * 2 * 8];
+	const uint8_t *b = head + sizeof(magic);
+	uint64_t dataSz = 0;
+	long fileSz;
+	FILE *fp;
+	int i;
+	
+	memset(x, 0, sizeof(*x));
+	
+	if (!(fp = fopen(fn, "rb")))
+		return -1;
+	
+	if (fread(head, 1, sizeof(head), fp) != sizeof(head)
+		|| memcmp(head, magic, sizeof(magic))
+		|| fseek(fp, 0, SEEK_END)
+		|| (fileSz = ftell(fp)) < (long)sizeof(head)
+		|| fseek(fp, sizeof(head), SEEK_SET)
+	)
+	{
+		fclose(fp);
+		return -1;
+	}
+	fileSz -= sizeof(head);
+	
+	x->datSz = rleu64(b); b += 8;
+	x->mtime = rleu64(b); b += 8;
+	x->hash = rleu64(b); b += 8;
+	x->probe = rleu64(b); b += 8;
+	for (i = 0; i < OPINDEX_LISTS; ++i)
+	{
+		uint64_t num = rleu64(b);
+		uint64_t sz = rleu64(b + 8);
+		
+		b += 16;
+		
+		/* every delta takes 1 to 10 bytes, and a dump of datSz bytes
+		 * has only so many commands, so nothing else can be genuine
+		 */
+		if (num > x->datSz / STRIDE
+			|| sz < num
+			|| sz > num * 10
+			|| sz > (uint64_t)(fileSz - dataSz)
+		)
+		{
+			fclose(fp);
+			memset(x, 0, sizeof(*x));
+			return -1;
+		}
+		dataSz += sz;
+		
+		x->list[i].num = num;
+		x->list[i].datSz = sz;
+		x->list[i].datCap = sz;
+	}
+	
+	for (i = 0; i < OPINDEX_LISTS; ++i)
+	{
+		size_t sz = x->list[i].datSz;
+		
+		if (!sz)
+			continue;
+		
+		if (!(x->list[i].dat = malloc(sz))
+			|| fread(x->list[i].dat, 1, sz, fp) != sz
+		)
+		{
+			fclose(fp);
+			opindexFree(x);
+			return -1;
+		}
+	}
+	
+	fclose(fp);
+	return 0;
+}
+
+void opindexFree(struct opindex *x)
+{
+	int i;
+	
+	for (i = 0; i < OPINDEX_LISTS; ++i)
+		free(x->list[i].dat);
+	memset(x, 0, sizeof(*x));
+}
+
+size_t *opindexList(const struct opindex *x, int which, size_t *num)
+{
+	const uint8_t *b = x->list[which].dat;
+	const uint8_t *end = b + x->list[which].datSz;
+	size_t *ofs;
+	size_t cmd = 0;
+	size_t i;
+	
+	if (!(ofs = malloc((x->list[which].num + 1) * sizeof(*ofs))))
+		return 0;
+	
+	for (i = 0; i < x->list[which].num && b < end; ++i)
+	{
+		size_t delta = 0;
+		int shift = 0;
+		
+		for ( ; b < end; shift += 7)
+		{
+			if (shift < (int)sizeof(delta) * 8)
+				delta |= (size_t)(*b & 0x7f) << shift;
+			if (!(*b++ & 0x80))
+				break;
+		}
+		
+		/* a command past the end of the dump means a damaged list */
+		cmd += delta;
+		if (cmd < delta || cmd >= x->datSz / STRIDE)
+			break;
+		ofs[i] = cmd * STRIDE;
+	}
+	
+	*num = i;
+	return ofs;
+}
@@ -0,0 +1,74 @@
+/*
+ * opindex.h <z64.me>
+ *
+ * on-disk index of where each command opcode and segment pointer
+ * appears in a dump, so repeated queries needn't rescan it
+ *
+ */
+
+#ifndef OPINDEX_H_INCLUDED
+#define OPINDEX_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* only scene and room header commands (opcodes 0x00-0x1f) are indexed;
+ * lists 0x00-0x1f hold them by opcode, and the other two hold those
+ * whose second word is a segment 0x02 or 0x03 pointer
+ */
+#define OPINDEX_OPS   0x20
+#define OPINDEX_SEG02 (OPINDEX_OPS + 0)
+#define OPINDEX_SEG03 (OPINDEX_OPS + 1)
+#define OPINDEX_LISTS (OPINDEX_OPS + 2)
+
+/* the offsets of every 8-byte aligned header command in a dump, grouped
+ * into lists; each list is sorted and delta-coded, so the index is
+ * compact; commands that are entirely zero (padding) aren't indexed
+ */
+struct opindex {
+	uint64_t datSz;         /* size of the dump */
+	int64_t mtime;          /* its modification time, when indexed */
+	uint64_t hash;          /* its contents, per opindexHash() */
+	uint64_t probe;         /* its first and last pages, per opindexProbe() */
+	struct {
+		uint8_t *dat;       /* varint deltas between command numbers */
+		size_t datSz;
+		size_t datCap;
+		size_t num;         /* offsets in the list */
+		size_t last;        /* most recent command number appended */
+	} list[OPINDEX_LISTS];
+};
+
+/* content hash identifying a dump */
+uint64_t opindexHash(const uint8_t *dat, size_t datSz);
+
+/* hash of only the first and last pages of a dump, cheap enough to
+ * check every time the index is used
+ */
+uint64_t opindexProbe(const uint8_t *dat, size_t datSz);
+
+/* indexes a dump in one pass
+ * returns 0 on success, non-zero on failure
+ */
+int opindexBuild(struct opindex *x, const uint8_t *dat, size_t datSz);
+
+/* writes an index to a file, replacing it only once complete
+ * returns 0 on success, non-zero on failure
+ */
+int opindexSave(const struct opindex *x, const char *fn);
+
+/* reads an index written by opindexSave(), rejecting any whose lists
+ * don't fit in the file or couldn't come from a dump of its size
+ * returns 0 on success, non-zero on failure
+ */
+int opindexLoad(struct opindex *x, const char *fn);
+
+/* releases an index */
+void opindexFree(struct opindex *x);
+
+/* decodes one list into an array of dump offsets, which the caller frees
+ * returns 0 on failure
+ */
+size_t *opindexList(const struct opindex *x, int which, size_t *num);
+
+#endif /* OPINDEX_H_INCLUDED */
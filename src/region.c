@@ -0,0 +1,139 @@
+/*
+ * region.c <z64.me>
+ *
+ * an input file read lazily, a page at a time, into an address range
+ * as large as the file, so only the parts of it that are used take up
+ * memory or are ever read
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "region.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define LOADED(R, P) ((R)->loaded[(P) >> 3] & (1 << ((P) & 7)))
+
+int regionOpen(struct region *r, const char *fn)
+{
+	struct stat st;
+	
+	memset(r, 0, sizeof(*r));
+	
+	if ((r->fd = open(fn, O_RDONLY)) < 0)
+		return -1;
+	
+	if (fstat(r->fd, &st) || st.st_size <= 0)
+		goto fail;
+	r->sz = st.st_size;
+	
+	/* untouched pages of an anonymous mapping cost nothing */
+	r->dat = mmap(0, r->sz, PROT_READ | PROT_WRITE
+		, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+	);
+	if (r->dat == MAP_FAILED)
+	{
+		r->dat = 0;
+		goto fail;
+	}
+	
+	if (!(r->loaded = calloc((r->sz / REGION_PAGE + 8) / 8, 1)))
+		goto fail;
+	
+	pthread_mutex_init(&r->lock, 0);
+	
+	return 0;
+
+fail:
+	if (r->dat)
+		munmap(r->dat, r->sz);
+	close(r->fd);
+	memset(r, 0, sizeof(*r));
+	return -1;
+}
+
+/* reads pages [first, end), none of which are loaded yet */
+static int readPages(struct region *r, size_t first, size_t end)
+{
+	size_t ofs = first * REGION_PAGE;
+	size_t stop = end * REGION_PAGE;
+	size_t p;
+	
+	if (stop > r->sz)
+		stop = r->sz;
+	
+	while (ofs < stop)
+	{
+		ssize_t got = pread(r->fd, r->dat + ofs, stop - ofs, ofs);
+		
+		if (got <= 0)
+			return -1;
+		ofs += got;
+		r->readBytes += got;
+		++r->readNum;
+	}
+	
+	for (p = first; p < end; ++p)
+		r->loaded[p >> 3] |= 1 << (p & 7);
+	
+	return 0;
+}
+
+int regionLoad(struct region *r, size_t lo, size_t hi)
+{
+	size_t first;
+	size_t end;
+	size_t p;
+	int rval = 0;
+	
+	if (hi > r->sz)
+		hi = r->sz;
+	if (lo >= hi)
+		return 0;
+	
+	first = lo / REGION_PAGE;
+	end = (hi + REGION_PAGE - 1) / REGION_PAGE;
+	
+	pthread_mutex_lock(&r->lock);
+	
+	/* consecutive missing pages are read together */
+	for (p = first; p < end && !rval; )
+	{
+		size_t run;
+		
+		if (LOADED(r, p))
+		{
+			++p;
+			continue;
+		}
+		
+		for (run = p + 1; run < end && !LOADED(r, run); ++run)
+			;
+		rval = readPages(r, p, run);
+		p = run;
+	}
+	
+	pthread_mutex_unlock(&r->lock);
+	
+	return rval;
+}
+
+void regionClose(struct region *r)
+{
+	if (!r->dat)
+		return;
+	
+	munmap(r->dat, r->sz);
+	close(r->fd);
+	free(r->loaded);
+	pthread_mutex_destroy(&r->lock);
+	memset(r, 0, sizeof(*r));
+}
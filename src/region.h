@@ -0,0 +1,46 @@
+/*
+ * region.h <z64.me>
+ *
+ * an input file read lazily, a page at a time, into an address range
+ * as large as the file, so only the parts of it that are used take up
+ * memory or are ever read
+ *
+ */
+
+#ifndef REGION_H_INCLUDED
+#define REGION_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define REGION_PAGE 4096 /* granularity of reads */
+
+/* a lazily-read file; dat spans the whole file, but only the pages
+ * loaded by regionLoad() hold its contents (the rest read as zero)
+ */
+struct region {
+	int fd;
+	uint8_t *dat;
+	size_t sz;
+	uint8_t *loaded;        /* one bit per page */
+	size_t readNum;         /* reads issued so far */
+	size_t readBytes;       /* bytes read so far */
+	pthread_mutex_t lock;
+};
+
+/* opens a file without reading any of it
+ * returns 0 on success, non-zero on failure
+ */
+int regionOpen(struct region *r, const char *fn);
+
+/* makes sure bytes [lo, hi) of dat hold the file's contents, reading
+ * any pages that weren't already; safe to call from multiple threads
+ * returns 0 on success, non-zero on failure
+ */
+int regionLoad(struct region *r, size_t lo, size_t hi);
+
+/* releases a region and closes its file */
+void regionClose(struct region *r);
+
+#endif /* REGION_H_INCLUDED */
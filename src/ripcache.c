@@ -0,0 +1,410 @@
+/*
+ * ripcache.c <z64.me>
+ *
+ * content-addressed cache of ripped scenes and converted rooms, so
+ * rerunning extract-scenes only redoes what changed
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ripcache.h"
+
+/* identifies a serialized log */
+static const uint8_t magic[8] = { 'R', 'I', 'P', 'L', 'O', 'G', 0, 2 };
+
+/* a growable byte buffer, for serializing */
+struct blob {
+	uint8_t *dat;
+	size_t sz;
+	size_t cap;
+	int fail;
+};
+
+/* scrambles the bits of v thoroughly */
+static uint64_t mix(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccd;
+	v ^= v >> 33;
+	v *= 0xc4ceb9fe1a85ec53;
+	v ^= v >> 33;
+	
+	return v;
+}
+
+/* feeds one 64-bit word to both halves of a key */
+static void feed(struct ripkey *k, uint64_t w)
+{
+	k->a = (k->a ^ w) * 0x100000001b3;
+	k->b = (k->b ^ mix(w)) * 0x9e3779b97f4a7c15;
+	k->b ^= k->b >> 29;
+}
+
+void ripkeyInit(struct ripkey *k, const char *stamp)
+{
+	k->a = 0xcbf29ce484222325;
+	k->b = 0x6a09e667f3bcc908;
+	ripkeyAdd(k, stamp, strlen(stamp));
+}
+
+void ripkeyAdd(struct ripkey *k, const void *dat, size_t sz)
+{
+	const uint8_t *b = dat;
+	uint64_t w;
+	size_t i;
+	
+	for (i = 0; i + 8 <= sz; i += 8)
+	{
+		memcpy(&w, b + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		w = __builtin_bswap64(w);
+#endif
+		feed(k, w);
+	}
+	
+	/* trailing bytes, then the length, so that no two inputs collide
+	 * merely by moving bytes between calls
+	 */
+	for (w = 0; i < sz; ++i)
+		w = (w << 8) | b[i];
+	feed(k, w);
+	feed(k, sz);
+}
+
+void ripkeyNum(struct ripkey *k, uint64_t v)
+{
+	feed(k, v);
+}
+
+/* path of the entry for a key; the caller frees it */
+static char *entrypath(const char *dir, const struct ripkey *k, const char *suffix)
+{
+	char *path;
+	
+	if (!(path = malloc(strlen(dir) + strlen(suffix) + 34)))
+		return 0;
+	
+	sprintf(path, "%s/%016llx%016llx%s"
+		, dir
+		, (unsigned long long)mix(k->a)
+		, (unsigned long long)mix(k->b ^ k->a)
+		, suffix
+	);
+	
+	return path;
+}
+
+void *ripcacheGet(const char *dir, const struct ripkey *k, size_t *sz)
+{
+	char *path;
+	FILE *fp = 0;
+	void *dat = 0;
+	long len;
+	
+	if (!(path = entrypath(dir, k, "")))
+		return 0;
+	
+	if (!(fp = fopen(path, "rb"))
+		|| fseek(fp, 0, SEEK_END)
+		|| (len = ftell(fp)) <= 0
+		|| fseek(fp, 0, SEEK_SET)
+		|| !(dat = malloc(len))
+		|| fread(dat, 1, len, fp) != (size_t)len
+	)
+	{
+		free(dat);
+		dat = 0;
+	}
+	else
+		*sz = len;
+	
+	if (fp)
+		fclose(fp);
+	free(path);
+	
+	return dat;
+}
+
+int ripcachePut(const char *dir, const struct ripkey *k, const void *dat, size_t sz)
+{
+	char *path;
+	char *tmp;
+	FILE *fp;
+	int fd;
+	int fail;
+	
+	if (!(path = entrypath(dir, k, "")))
+		return -1;
+	if (!(tmp = entrypath(dir, k, ".XXXXXX")))
+	{
+		free(path);
+		return -1;
+	}
+	
+	/* unique, so two threads making the same entry don't collide */
+	if ((fd = mkstemp(tmp)) < 0 || !(fp = fdopen(fd, "wb")))
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			remove(tmp);
+		}
+		free(path);
+		free(tmp);
+		return -1;
+	}
+	
+	fail = fwrite(dat, 1, sz, fp) != sz;
+	fail |= fclose(fp) != 0;
+	if (fail || rename(tmp, path))
+	{
+		remove(tmp);
+		fail = 1;
+	}
+	
+	free(path);
+	free(tmp);
+	
+	return fail ? -1 : 0;
+}
+
+/* make room for n more elements of size each in a growable array */
+static int reserve(void **arr, size_t num, size_t *cap, size_t n, size_t each)
+{
+	if (num + n > *cap)
+	{
+		size_t want = *cap ? *cap * 2 : 16;
+		void *tmp;
+		
+		while (want < num + n)
+			want *= 2;
+		if (!(tmp = realloc(*arr, want * each)))
+			return -1;
+		*arr = tmp;
+		*cap = want;
+	}
+	
+	return 0;
+}
+
+/* copy of a buffer; zero-sized buffers are copied too */
+static uint8_t *copy(const void *dat, size_t sz)
+{
+	uint8_t *b = malloc(sz ? sz : 1);
+	
+	if (b)
+		memcpy(b, dat, sz);
+	
+	return b;
+}
+
+void riplogFile(struct riplog *log, const char *name, const void *dat, size_t sz)
+{
+	struct ripfile *f;
+	
+	if (log->fail
+		|| reserve((void**)&log->file, log->fileNum, &log->fileCap, 1, sizeof(*log->file))
+	)
+	{
+		log->fail = 1;
+		return;
+	}
+	
+	f = log->file + log->fileNum;
+	f->sz = sz;
+	if (!(f->name = strdup(name)) || !(f->dat = copy(dat, sz)))
+	{
+		free(f->name);
+		log->fail = 1;
+		return;
+	}
+	++log->fileNum;
+}
+
+void riplogClaim(struct riplog *log, size_t lo, size_t hi)
+{
+	if (log->fail
+		|| reserve((void**)&log->claim, log->claimNum, &log->claimCap, 1, sizeof(*log->claim))
+	)
+	{
+		log->fail = 1;
+		return;
+	}
+	
+	log->claim[log->claimNum].lo = lo;
+	log->claim[log->claimNum].hi = hi;
+	++log->claimNum;
+}
+
+/* appends bytes to a blob */
+static void put(struct blob *b, const void *dat, size_t sz)
+{
+	if (b->fail || reserve((void**)&b->dat, b->sz, &b->cap, sz, 1))
+	{
+		b->fail = 1;
+		return;
+	}
+	
+	memcpy(b->dat + b->sz, dat, sz);
+	b->sz += sz;
+}
+
+/* appends a little-endian u64 to a blob */
+static void put64(struct blob *b, uint64_t v)
+{
+	uint8_t w[8];
+	int i;
+	
+	for (i = 0; i < 8; ++i)
+		w[i] = v >> (i * 8);
+	
+	put(b, w, sizeof(w));
+}
+
+int riplogPut(const struct riplog *log, const char *dir, const struct ripkey *k)
+{
+	struct blob b = {0};
+	size_t i;
+	int rval;
+	
+	if (log->fail)
+		return -1;
+	
+	put(&b, magic, sizeof(magic));
+	put64(&b, log->fileNum);
+	for (i = 0; i < log->fileNum; ++i)
+	{
+		put64(&b, strlen(log->file[i].name));
+		put(&b, log->file[i].name, strlen(log->file[i].name));
+		put64(&b, log->file[i].sz);
+		put(&b, log->file[i].dat, log->file[i].sz);
+	}
+	put64(&b, log->claimNum);
+	for (i = 0; i < log->claimNum; ++i)
+	{
+		put64(&b, log->claim[i].lo);
+		put64(&b, log->claim[i].hi);
+	}
+	
+	rval = b.fail ? -1 : ripcachePut(dir, k, b.dat, b.sz);
+	free(b.dat);
+	
+	return rval;
+}
+
+/* reads a little-endian u64 from a serialized log, failing past its end */
+static int get64(const uint8_t **b, const uint8_t *end, uint64_t *v)
+{
+	int i;
+	
+	if (end - *b < 8)
+		return -1;
+	
+	for (*v = 0, i = 0; i < 8; ++i)
+		*v |= (uint64_t)(*b)[i] << (i * 8);
+	*b += 8;
+	
+	return 0;
+}
+
+/* reads sz bytes from a serialized log into a fresh buffer */
+static uint8_t *getbytes(const uint8_t **b, const uint8_t *end, uint64_t sz)
+{
+	uint8_t *dat;
+	
+	if ((uint64_t)(end - *b) < sz || !(dat = copy(*b, sz)))
+		return 0;
+	*b += sz;
+	
+	return dat;
+}
+
+int riplogGet(struct riplog *log, const char *dir, const struct ripkey *k)
+{
+	const uint8_t *b;
+	const uint8_t *end;
+	uint8_t *dat;
+	size_t sz;
+	uint64_t num;
+	uint64_t v;
+	uint64_t i;
+	
+	memset(log, 0, sizeof(*log));
+	
+	if (!(dat = ripcacheGet(dir, k, &sz)))
+		return -1;
+	b = dat;
+	end = dat + sz;
+	
+	if (sz < sizeof(magic) || memcmp(b, magic, sizeof(magic)))
+		goto fail;
+	b += sizeof(magic);
+	
+	if (get64(&b, end, &num)
+		|| reserve((void**)&log->file, 0, &log->fileCap, num, sizeof(*log->file))
+	)
+		goto fail;
+	for (i = 0; i < num; ++i)
+	{
+		struct ripfile *f = log->file + log->fileNum++;
+		
+		memset(f, 0, sizeof(*f));
+		if (get64(&b, end, &v)
+			|| (uint64_t)(end - b) < v
+			|| !(f->name = malloc(v + 1))
+		)
+			goto fail;
+		memcpy(f->name, b, v);
+		f->name[v] = '\0';
+		b += v;
+		if (get64(&b, end, &v)
+			|| !(f->dat = getbytes(&b, end, v))
+		)
+			goto fail;
+		f->sz = v;
+	}
+	
+	if (get64(&b, end, &num)
+		|| reserve((void**)&log->claim, 0, &log->claimCap, num, sizeof(*log->claim))
+	)
+		goto fail;
+	for (i = 0; i < num; ++i, ++log->claimNum)
+	{
+		if (get64(&b, end, &v))
+			goto fail;
+		log->claim[i].lo = v;
+		if (get64(&b, end, &v))
+			goto fail;
+		log->claim[i].hi = v;
+	}
+	
+	if (b != end)
+		goto fail;
+	
+	free(dat);
+	return 0;
+
+fail:
+	free(dat);
+	riplogFree(log);
+	return -1;
+}
+
+void riplogFree(struct riplog *log)
+{
+	size_t i;
+	
+	for (i = 0; i < log->fileNum; ++i)
+	{
+		free(log->file[i].name);
+		free(log->file[i].dat);
+	}
+	
+	free(log->file);
+	free(log->claim);
+	memset(log, 0, sizeof(*log));
+}
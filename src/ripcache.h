@@ -0,0 +1,85 @@
+/*
+ * ripcache.h <z64.me>
+ *
+ * content-addressed cache of ripped scenes and converted rooms, so
+ * rerunning extract-scenes only redoes what changed
+ *
+ */
+
+#ifndef RIPCACHE_H_INCLUDED
+#define RIPCACHE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 128-bit hash identifying an entry */
+struct ripkey {
+	uint64_t a;
+	uint64_t b;
+};
+
+/* one file written by a rip */
+struct ripfile {
+	char *name;             /* relative to the scene's directory */
+	uint8_t *dat;
+	size_t sz;
+};
+
+/* a range of the rom a rip claimed */
+struct ripclaim {
+	size_t lo;
+	size_t hi;
+};
+
+/* everything ripping a scene did, so it can be done again without
+ * ripping: the files it wrote and the ranges it claimed, each in the
+ * order they happened
+ */
+struct riplog {
+	struct ripfile *file;
+	size_t fileNum;
+	size_t fileCap;
+	struct ripclaim *claim;
+	size_t claimNum;
+	size_t claimCap;
+	int fail;               /* ran out of memory while logging */
+};
+
+/* starts a key; stamp identifies the version of whatever makes the
+ * entry, so entries made by other versions are never used
+ */
+void ripkeyInit(struct ripkey *k, const char *stamp);
+
+/* adds bytes to a key */
+void ripkeyAdd(struct ripkey *k, const void *dat, size_t sz);
+
+/* adds a number to a key */
+void ripkeyNum(struct ripkey *k, uint64_t v);
+
+/* reads the entry for a key from a cache directory
+ * returns a buffer the caller frees, or 0 if there is none
+ */
+void *ripcacheGet(const char *dir, const struct ripkey *k, size_t *sz);
+
+/* writes the entry for a key to a cache directory; the entry appears
+ * all at once, so concurrent readers never see half of it
+ * returns 0 on success, non-zero on failure
+ */
+int ripcachePut(const char *dir, const struct ripkey *k, const void *dat, size_t sz);
+
+/* logs a file being written */
+void riplogFile(struct riplog *log, const char *name, const void *dat, size_t sz);
+
+/* logs a range being claimed */
+void riplogClaim(struct riplog *log, size_t lo, size_t hi);
+
+/* writes a log to, or reads one from, the cache entry for a key
+ * returns 0 on success, non-zero on failure
+ */
+int riplogPut(const struct riplog *log, const char *dir, const struct ripkey *k);
+int riplogGet(struct riplog *log, const char *dir, const struct ripkey *k);
+
+/* releases a log; it is left empty and can be reused */
+void riplogFree(struct riplog *log);
+
+#endif /* RIPCACHE_H_INCLUDED */
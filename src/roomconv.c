@@ -0,0 +1,1217 @@
+/*
+ * roomconv.c <z64.me>
+ *
+ * converts a room's microcode in memory, from f3dex to f3dex2 unless
+ * another pair of microcodes is selected
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "roomconv.h"
+#include "ucode.h"
+#include "stats.h"
+
+/* temp file name templates; unique per call, so concurrent
+ * conversions can share a working directory
+ */
+#define STR_BIN "procDlist.bin.XXXXXX"
+#define STR_TXT "procDlist.txt.XXXXXX"
+
+/* big-endian bytes to u32 */
+static inline unsigned beU32(void *bytes)
+{
+	unsigned char *b = bytes;
+	return ((unsigned)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* write u32 as big-endian bytes */
+static inline void wbeU32(void *bytes, unsigned v)
+{
+	unsigned char *b = bytes;
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* process segment pointer (skip any that don't reference room, or
+ * that point past the end of it)
+ */
+static inline void *pointer(void *room, unsigned roomSz, void *bytes)
+{
+	unsigned v = beU32(bytes);
+	unsigned char seg = v >> 24;
+	unsigned ofs = v & 0xffffff;
+	
+	if (!v)
+		return 0;
+	
+	if (!room)
+		return 0;
+	
+	if (seg != 3)
+		return 0;
+	
+	if (ofs >= roomSz)
+		return 0;
+	
+	//assert(seg < 16);
+	
+	return ((char*)room) + ofs;
+}
+
+/* non-zero if sz bytes at p lie entirely within room */
+static inline int within(void *room, unsigned roomSz, void *p, unsigned sz)
+{
+	unsigned char *b = p;
+	
+	if (!b || b < (unsigned char*)room)
+		return 0;
+	
+	return sz <= roomSz && b - (unsigned char*)room <= roomSz - sz;
+}
+
+/* minimal file writer
+ * returns 0 on failure
+ * returns non-zero on success
+ */
+static int savefile(const char *fn, const void *dat, const size_t sz)
+{
+	FILE *fp;
+	
+	/* rudimentary error checking returns 0 on any error */
+	if (
+		!fn
+		|| !sz
+		|| !dat
+		|| !(fp = fopen(fn, "wb"))
+		|| fwrite(dat, 1, sz, fp) != sz
+		|| fclose(fp)
+	)
+		return 0;
+	
+	return 1;
+}
+
+/* microcodes rooms are converted between; 0 until one is selected */
+static const struct ucodePair *gPair = 0;
+
+/* the selected pair, or else the one rooms have always used */
+static const struct ucodePair *pair(void)
+{
+	return gPair ? gPair : ucodePairFind(UCODE_DEFAULT);
+}
+
+/* convert display list using the built-in translator for the pair
+ * returns 0 on success, non-zero on an unsupported command
+ */
+static int convertNative(unsigned char *dlist, unsigned sz)
+{
+	const struct ucodePair *p = pair();
+	
+	/* already in the target's encoding */
+	if (p->same)
+		return 0;
+	
+	return p->translate(dlist, sz);
+}
+
+/* runs an external tool, counting the time spent waiting on it */
+static void subprocess(const char *name, const char *cmd)
+{
+	double start = statsNow();
+	
+	system(cmd);
+	
+	statsAdd(STAT_SUBPROCESSES, 1);
+	statsAdd(STAT_SUBPROCESS_US, statsNow() - start);
+	statsSpan("subprocess", start, "%s", name);
+}
+
+/* run a buffer through the external gfxdis/gfxasm round trip using
+ * private temp files, so concurrent runs can share a working directory;
+ * a non-zero cmdNum disassembles that many commands, rather than
+ * stopping at the first G_ENDDL
+ * returns number of bytes read back into buf, or 0 on failure
+ */
+static unsigned roundTrip(unsigned char *buf, unsigned sz, unsigned cmdNum)
+{
+	char bin[] = STR_BIN;
+	char txt[] = STR_TXT;
+	char cmd[256];
+	FILE *fp;
+	unsigned result = 0;
+	int fd;
+	
+	if ((fd = mkstemp(bin)) < 0)
+		return 0;
+	close(fd);
+	if ((fd = mkstemp(txt)) < 0)
+	{
+		remove(bin);
+		return 0;
+	}
+	close(fd);
+	
+	if (savefile(bin, buf, sz))
+	{
+		if (cmdNum)
+			sprintf(cmd, "bin/gfxdis.f3dex -n %u -f %s > %s", cmdNum, bin, txt);
+		else
+			sprintf(cmd, "bin/gfxdis.f3dex -f %s > %s", bin, txt);
+		subprocess("gfxdis", cmd);
+		sprintf(cmd, "bin/gfxasm.f3dex2 -b < %s > %s 2> /dev/null", txt, bin);
+		subprocess("gfxasm", cmd);
+		
+		/* overwrite old display list with newly-converted binary */
+		if ((fp = fopen(bin, "rb")))
+		{
+			result = fread(buf, 1, sz, fp);
+			fclose(fp);
+		}
+	}
+	
+	/* cleanup */
+	remove(bin);
+	remove(txt);
+	
+	return result;
+}
+
+/* convert display list using the external gfxdis/gfxasm round trip;
+ * slow, but kept as a reference for comparing the built-in translator
+ * returns 0 on success, non-zero on failure
+ */
+static int convertExternal(unsigned char *dlist, unsigned sz)
+{
+	if (!roundTrip(dlist, sz, 0))
+	{
+		fprintf(stderr, "file buffer fail\n");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* number of threads roomconv() may spread a room's display lists across */
+static int gThreads = 1;
+
+/* rooms with fewer display list bytes than this aren't worth threading */
+#define THREAD_MIN_BYTES (64 * 1024)
+
+/* display list node states */
+#define DLNODE_NEW  0 /* discovered, not yet walked */
+#define DLNODE_OPEN 1 /* walked, descendants being visited */
+#define DLNODE_DONE 2 /* it and all its descendants are visited */
+
+/* a display list within a room */
+struct dlnode {
+	unsigned ofs;           /* room offset of first command */
+	unsigned sz;            /* length in bytes, including G_ENDDL */
+	unsigned edge;          /* index of first outgoing edge */
+	unsigned edgeNum;       /* number of outgoing edges */
+	unsigned cursor;        /* next edge to visit during traversal */
+	unsigned char state;
+};
+
+/* a run of consecutive slots that are converted together */
+struct dlunit {
+	unsigned ofs;
+	unsigned sz;
+};
+
+/* every display list reachable from a room's mesh header;
+ * each list is a node, each G_DL referencing another is an edge
+ */
+struct dlgraph {
+	unsigned char *room;
+	unsigned roomSz;
+	int flags;              /* ROOMCONV_* flags */
+	unsigned char dl;       /* G_DL and G_ENDDL of the source microcode */
+	unsigned char enddl;
+	unsigned *index;        /* node number + 1 of each 8-byte room slot */
+	unsigned char *done;    /* non-zero for each slot already converted */
+	struct dlnode *node;
+	unsigned nodeNum;
+	unsigned nodeCap;
+	unsigned *edge;         /* destination node of each edge */
+	unsigned edgeNum;
+	unsigned edgeCap;
+	unsigned *stack;        /* traversal stack, so no C recursion */
+	unsigned stackCap;
+	struct dlunit *unit;    /* conversion work, disjoint byte ranges */
+	unsigned unitNum;
+	unsigned unitCap;
+	unsigned unitBytes;     /* sum of every unit's size */
+	unsigned refNum;        /* mesh header references to valid lists */
+	unsigned cycleNum;      /* edges leading back into an open node */
+	int fail;               /* non-zero if any unit failed to convert */
+	unsigned cmdNum;        /* commands before optimizing, no-ops aside */
+	unsigned cmdNumOptimized; /* and after */
+	unsigned stateDropped;  /* redundant state changes dropped */
+	unsigned triPaired;     /* G_TRI1 pairs merged into G_TRI2 */
+};
+
+/* one worker's share of the units; the owner takes work from the
+ * head, idle workers steal from the tail
+ */
+struct dldeque {
+	unsigned head;
+	unsigned tail;
+	pthread_mutex_t lock;
+};
+
+/* conversion work shared by every worker */
+struct dlwork {
+	struct dlgraph *g;
+	struct dldeque *deque;
+	int dequeNum;
+};
+
+/* a worker and its deque */
+struct dlworker {
+	struct dlwork *work;
+	int which;
+};
+
+#define DLGRAPH_NONE (~0u)
+
+/* grow an array to fit at least num items
+ * returns 0 on success, non-zero on failure
+ */
+static int grow(void *arrp, unsigned *cap, unsigned num, size_t itemSz)
+{
+	void **arr = arrp;
+	unsigned newCap = *cap ? *cap : 64;
+	void *tmp;
+	
+	if (num <= *cap)
+		return 0;
+	
+	while (newCap < num)
+		newCap *= 2;
+	
+	if (!(tmp = realloc(*arr, newCap * itemSz)))
+		return -1;
+	
+	*arr = tmp;
+	*cap = newCap;
+	
+	return 0;
+}
+
+/* retrieve node for display list, adding it if it is new
+ * returns DLGRAPH_NONE if it isn't a valid display list address
+ */
+static unsigned dlgraphNode(struct dlgraph *g, unsigned char *dlist)
+{
+	struct dlnode *n;
+	unsigned ofs;
+	
+	if (!dlist)
+		return DLGRAPH_NONE;
+	
+	ofs = dlist - g->room;
+	
+	/* the rsp only fetches display lists from 64-bit aligned addresses */
+	if (ofs >= g->roomSz || (ofs & 7))
+	{
+		fprintf(stderr, "ignoring invalid display list 0x%08x\n", ofs);
+		return DLGRAPH_NONE;
+	}
+	
+	if (g->index[ofs / 8])
+		return g->index[ofs / 8] - 1;
+	
+	if (grow(&g->node, &g->nodeCap, g->nodeNum + 1, sizeof(*g->node)))
+		return DLGRAPH_NONE;
+	
+	n = g->node + g->nodeNum;
+	memset(n, 0, sizeof(*n));
+	n->ofs = ofs;
+	n->state = DLNODE_NEW;
+	g->index[ofs / 8] = ++g->nodeNum;
+	
+	return g->nodeNum - 1;
+}
+
+/* walk an unconverted display list, measuring it and recording its edges */
+static int dlgraphWalk(struct dlgraph *g, unsigned which)
+{
+	unsigned char *start = g->room + g->node[which].ofs;
+	unsigned char *end = g->room + (g->roomSz & ~7);
+	unsigned char *b;
+	int branched = 0;
+	
+	g->node[which].edge = g->edgeNum;
+	
+	for (b = start; b < end && *b != g->enddl; b += 8)
+	{
+		unsigned dst;
+		
+		/* G_DL; anything after a branch is never executed */
+		if (*b != g->dl || branched)
+			continue;
+		
+		if ((dst = dlgraphNode(g, pointer(g->room, g->roomSz, b + 4))) != DLGRAPH_NONE)
+		{
+			if (grow(&g->edge, &g->edgeCap, g->edgeNum + 1, sizeof(*g->edge)))
+				return -1;
+			g->edge[g->edgeNum++] = dst;
+		}
+		
+		if (b[1])
+			branched = 1;
+	}
+	
+	if (b >= end)
+		fprintf(stderr, "display list 0x%08x has no end\n", g->node[which].ofs);
+	else
+		b += 8;
+	
+	g->node[which].sz = b - start;
+	g->node[which].edgeNum = g->edgeNum - g->node[which].edge;
+	g->node[which].state = DLNODE_OPEN;
+	
+	return 0;
+}
+
+/* add a display list referenced by a mesh header, and visit
+ * everything reachable from it that hasn't been visited yet
+ */
+static int dlgraphRoot(struct dlgraph *g, void *dlist)
+{
+	unsigned root;
+	unsigned sp = 0;
+	
+	if (!dlist)
+		return 0;
+	
+	if ((root = dlgraphNode(g, dlist)) == DLGRAPH_NONE)
+		return 0;
+	
+	++g->refNum;
+	
+	if (g->node[root].state != DLNODE_NEW)
+		return 0;
+	
+	if (dlgraphWalk(g, root)
+		|| grow(&g->stack, &g->stackCap, sp + 1, sizeof(*g->stack))
+	)
+		return -1;
+	g->stack[sp++] = root;
+	
+	/* depth-first, with an explicit stack */
+	while (sp)
+	{
+		struct dlnode *n = g->node + g->stack[sp - 1];
+		unsigned dst;
+		
+		if (n->cursor == n->edgeNum)
+		{
+			n->state = DLNODE_DONE;
+			--sp;
+			continue;
+		}
+		
+		dst = g->edge[n->edge + n->cursor++];
+		
+		if (g->node[dst].state == DLNODE_OPEN)
+			++g->cycleNum;
+		else if (g->node[dst].state == DLNODE_NEW)
+		{
+			if (dlgraphWalk(g, dst)
+				|| grow(&g->stack, &g->stackCap, sp + 1, sizeof(*g->stack))
+			)
+				return -1;
+			g->stack[sp++] = dst;
+		}
+	}
+	
+	return 0;
+}
+
+/* convert one unit with whichever translator was requested; a unit
+ * that fails is left as it is, and fails the whole room
+ */
+static void dlunitConvert(struct dlgraph *g, struct dlunit *unit)
+{
+	int rval;
+	
+	if (g->flags & (ROOMCONV_REFERENCE | ROOMCONV_BATCH))
+		rval = convertExternal(g->room + unit->ofs, unit->sz);
+	else
+		rval = convertNative(g->room + unit->ofs, unit->sz);
+	
+	if (rval)
+		__atomic_store_n(&g->fail, 1, __ATOMIC_RELAXED);
+}
+
+/* take next unit from the worker's own deque, or steal one from the
+ * tail of another worker's; no new units are ever created, so once
+ * every deque is empty, the worker is done
+ * returns 0 if there is no work left
+ */
+static struct dlunit *dlworkTake(struct dlwork *work, int which)
+{
+	struct dlunit *unit = 0;
+	int i;
+	
+	for (i = 0; i < work->dequeNum && !unit; ++i)
+	{
+		struct dldeque *dq = work->deque + (which + i) % work->dequeNum;
+		
+		pthread_mutex_lock(&dq->lock);
+		if (dq->head < dq->tail)
+		{
+			if (i == 0)
+				unit = work->g->unit + dq->head++;
+			else
+				unit = work->g->unit + --dq->tail;
+		}
+		pthread_mutex_unlock(&dq->lock);
+	}
+	
+	return unit;
+}
+
+/* worker thread; converts units until there are none left */
+static void *dlworkRun(void *arg)
+{
+	struct dlworker *worker = arg;
+	struct dlunit *unit;
+	double start = statsNow();
+	unsigned num = 0;
+	
+	for ( ; (unit = dlworkTake(worker->work, worker->which)); ++num)
+		dlunitConvert(worker->work->g, unit);
+	
+	statsSpan("roomconv", start, "translate %u units", num);
+	
+	return 0;
+}
+
+/* convert every unit across gThreads threads
+ * returns 0 on success, non-zero if threads couldn't be set up
+ */
+static int dlgraphConvertParallel(struct dlgraph *g)
+{
+	struct dlwork work = {0};
+	struct dlworker *worker = 0;
+	pthread_t *thread = 0;
+	unsigned share;
+	unsigned bytes;
+	unsigned i;
+	int threads = gThreads;
+	int started;
+	int k;
+	
+	if ((unsigned)threads > g->unitNum)
+		threads = g->unitNum;
+	
+	if (!(work.deque = calloc(threads, sizeof(*work.deque)))
+		|| !(worker = calloc(threads, sizeof(*worker)))
+		|| !(thread = calloc(threads, sizeof(*thread)))
+	)
+	{
+		free(work.deque);
+		free(worker);
+		return -1;
+	}
+	
+	/* deal contiguous units out to each deque by byte count */
+	share = g->unitBytes / threads + 1;
+	for (i = 0, k = 0, bytes = 0; i < g->unitNum; ++i)
+	{
+		if (bytes >= share && k + 1 < threads)
+		{
+			work.deque[++k].head = i;
+			bytes = 0;
+		}
+		work.deque[k].tail = i + 1;
+		bytes += g->unit[i].sz;
+	}
+	for (k = 0; k < threads; ++k)
+	{
+		pthread_mutex_init(&work.deque[k].lock, 0);
+		worker[k].work = &work;
+		worker[k].which = k;
+	}
+	work.g = g;
+	work.dequeNum = threads;
+	
+	/* this thread is worker 0; the units of any worker that
+	 * fails to start are stolen by the others
+	 */
+	for (started = 1; started < threads; ++started)
+		if (pthread_create(thread + started, 0, dlworkRun, worker + started))
+			break;
+	dlworkRun(worker);
+	for (k = 1; k < started; ++k)
+		pthread_join(thread[k], 0);
+	
+	for (k = 0; k < threads; ++k)
+		pthread_mutex_destroy(&work.deque[k].lock);
+	free(work.deque);
+	free(worker);
+	free(thread);
+	
+	return 0;
+}
+
+/* convert every unit in a single external round trip; each unit is
+ * preceded by a tagged G_NOOP, which is 0xc0 in f3dex and comes back as
+ * 0x00 in f3dex2 with its tag intact, so the converted stream can be
+ * checked and split back to the original offsets; this depends on the
+ * converter mapping one to the other
+ * returns 0 on success, non-zero if the stream couldn't be split
+ */
+static int dlgraphConvertBatch(struct dlgraph *g)
+{
+	unsigned char *buf;
+	unsigned char *b;
+	unsigned sz = g->unitBytes + g->unitNum * 8;
+	unsigned i;
+	
+	if (!(buf = malloc(sz)))
+		return -1;
+	
+	for (i = 0, b = buf; i < g->unitNum; ++i)
+	{
+		wbeU32(b, 0xc0000000); /* f3dex G_NOOP */
+		wbeU32(b + 4, i);
+		memcpy(b + 8, g->room + g->unit[i].ofs, g->unit[i].sz);
+		b += 8 + g->unit[i].sz;
+	}
+	
+	if (roundTrip(buf, sz, sz / 8) != sz)
+	{
+		free(buf);
+		return -1;
+	}
+	
+	/* confirm every marker survived at its original position */
+	for (i = 0, b = buf; i < g->unitNum; ++i)
+	{
+		if (beU32(b) != 0x00000000 /* f3dex2 G_NOOP */ || beU32(b + 4) != i)
+		{
+			free(buf);
+			return -1;
+		}
+		b += 8 + g->unit[i].sz;
+	}
+	
+	for (i = 0, b = buf; i < g->unitNum; ++i)
+	{
+		memcpy(g->room + g->unit[i].ofs, b + 8, g->unit[i].sz);
+		b += 8 + g->unit[i].sz;
+	}
+	
+	free(buf);
+	return 0;
+}
+
+int roomconvBatchSupported(void)
+{
+	unsigned char buf[32];
+	unsigned i;
+	
+	/* two marked lists, as dlgraphConvertBatch() writes them; a gfxdis
+	 * without -n stops at the first G_ENDDL, or fails outright
+	 */
+	for (i = 0; i < 2; ++i)
+	{
+		wbeU32(buf + i * 16, 0xc0000000); /* f3dex G_NOOP */
+		wbeU32(buf + i * 16 + 4, i);
+		wbeU32(buf + i * 16 + 8, 0xb8000000); /* f3dex G_ENDDL */
+		wbeU32(buf + i * 16 + 12, 0);
+	}
+	
+	if (roundTrip(buf, sizeof(buf), sizeof(buf) / 8) != sizeof(buf))
+		return 0;
+	
+	return beU32(buf + 16) == 0x00000000 && beU32(buf + 20) == 1
+		&& beU32(buf + 24) == 0xdf000000
+	;
+}
+
+/* convert every node exactly once; lists that overlap the tail of
+ * another list only have their not-yet-converted slots converted
+ */
+static int dlgraphConvert(struct dlgraph *g)
+{
+	unsigned i;
+	
+	/* split the graph into disjoint units of work */
+	for (i = 0; i < g->nodeNum; ++i)
+	{
+		unsigned slot = g->node[i].ofs / 8;
+		unsigned slotEnd = slot + g->node[i].sz / 8;
+		
+		while (slot < slotEnd)
+		{
+			unsigned run;
+			
+			if (g->done[slot])
+			{
+				++slot;
+				continue;
+			}
+			
+			for (run = slot; run < slotEnd && !g->done[run]; ++run)
+				g->done[run] = 1;
+			
+			if (grow(&g->unit, &g->unitCap, g->unitNum + 1, sizeof(*g->unit)))
+				return -1;
+			g->unit[g->unitNum].ofs = slot * 8;
+			g->unit[g->unitNum].sz = (run - slot) * 8;
+			g->unitBytes += g->unit[g->unitNum].sz;
+			++g->unitNum;
+			
+			slot = run;
+		}
+	}
+	
+	if ((g->flags & ROOMCONV_BATCH) && g->unitNum)
+	{
+		if (dlgraphConvertBatch(g))
+		{
+			fprintf(stderr, "batched conversion failed, converting one by one\n");
+			for (i = 0; i < g->unitNum; ++i)
+				dlunitConvert(g, g->unit + i);
+		}
+	}
+	else if (gThreads < 2
+		|| g->unitNum < 2
+		|| g->unitBytes < THREAD_MIN_BYTES
+		|| dlgraphConvertParallel(g)
+	)
+	{
+		for (i = 0; i < g->unitNum; ++i)
+			dlunitConvert(g, g->unit + i);
+	}
+	
+	/* a room that couldn't be converted isn't patched either */
+	if (g->fail)
+		return -1;
+	
+	/* walk each converted display list, misc. patches */
+	for (i = 0; i < g->nodeNum; ++i)
+	{
+		unsigned char *b = g->room + g->node[i].ofs;
+		unsigned char *end = b + g->node[i].sz;
+		
+		for ( ; b < end && *b != 0xdf; b += 8)
+		{
+			/* G_DL */
+			if (*b == 0xde)
+			{
+				/* disable animated textures */
+				if (b[4] != 0x03 && (beU32(b + 4) & 0xffffff) == 0)
+				{
+					*b = 0;
+					if (b[1])
+						*b = 0xdf;
+				}
+				
+				/* functions as end of dlist */
+				if (b[1])
+					break;
+			}
+			/* use tri2 instead of quad */
+			else if (*b == 0x07)
+				*b = 0x06;
+		}
+	}
+	
+	return 0;
+}
+
+/* the most state-setting commands remembered at once */
+#define DLSTATE_MAX 32
+
+/* the state-setting commands in effect since state was last unknown */
+struct dlstate {
+	unsigned char cmd[DLSTATE_MAX][8];
+	unsigned mask[DLSTATE_MAX];
+	unsigned num;
+};
+
+/* the bits of state an f3dex2 command sets, within the state named by
+ * its opcode; zero if it isn't one the optimizer keeps track of
+ */
+static unsigned dlstateMask(unsigned char *b)
+{
+	unsigned len;
+	
+	switch (*b)
+	{
+		/* G_SETOTHERMODE_L, G_SETOTHERMODE_H: one field of the word */
+		case 0xe2:
+		case 0xe3:
+			len = b[3] + 1;
+			if (b[2] + len >= 32)
+				return ~0u;
+			return ((1u << len) - 1) << (32 - b[2] - len);
+		
+		/* G_GEOMETRYMODE: the bits it clears, and those it sets */
+		case 0xd9:
+			return (~beU32(b) & 0xffffff) | beU32(b + 4);
+		
+		/* G_SETTILESIZE, G_SETTILE: one tile descriptor */
+		case 0xf2:
+		case 0xf5:
+			return 1u << (b[4] & 7);
+		
+		/* G_TEXTURE, G_RDPSETOTHERMODE, G_SETFOGCOLOR, G_SETBLENDCOLOR,
+		 * G_SETPRIMCOLOR, G_SETENVCOLOR, G_SETCOMBINE
+		 */
+		case 0xd7:
+		case 0xef:
+		case 0xf8:
+		case 0xf9:
+		case 0xfa:
+		case 0xfb:
+		case 0xfc:
+			return ~0u;
+	}
+	
+	return 0;
+}
+
+/* forget the commands with opcode op that set any of the bits in mask */
+static void dlstateForget(struct dlstate *s, unsigned char op, unsigned mask)
+{
+	unsigned i;
+	
+	for (i = 0; i < s->num; )
+	{
+		if (s->cmd[i][0] == op && (s->mask[i] & mask))
+		{
+			--s->num;
+			memcpy(s->cmd[i], s->cmd[s->num], 8);
+			s->mask[i] = s->mask[s->num];
+		}
+		else
+			++i;
+	}
+}
+
+/* track a command's effect on state
+ * returns non-zero if the command is redundant, because the state
+ * it sets is already in effect
+ */
+static int dlstateSet(struct dlstate *s, unsigned char *b)
+{
+	unsigned mask = dlstateMask(b);
+	unsigned i;
+	
+	switch (*b)
+	{
+		/* G_DL and G_LOAD_UCODE: anything could have changed */
+		case 0xde:
+		case 0xdd:
+			s->num = 0;
+			return 0;
+		
+		/* G_LOADTLUT, G_LOADBLOCK, G_LOADTILE: tile size is rewritten */
+		case 0xf0:
+		case 0xf3:
+		case 0xf4:
+			dlstateForget(s, 0xf2, 1u << (b[4] & 7));
+			return 0;
+		
+		/* G_RDPSETOTHERMODE and the othermode fields overlap */
+		case 0xef:
+			dlstateForget(s, 0xe2, ~0u);
+			dlstateForget(s, 0xe3, ~0u);
+			break;
+		case 0xe2:
+		case 0xe3:
+			dlstateForget(s, 0xef, ~0u);
+			break;
+	}
+	
+	if (!mask)
+		return 0;
+	
+	for (i = 0; i < s->num; ++i)
+		if (!memcmp(s->cmd[i], b, 8))
+			return 1;
+	
+	dlstateForget(s, *b, mask);
+	if (s->num == DLSTATE_MAX)
+		s->num = 0;
+	memcpy(s->cmd[s->num], b, 8);
+	s->mask[s->num] = mask;
+	++s->num;
+	
+	return 0;
+}
+
+/* optimize converted slots [slot, slotEnd), which are entered at slot
+ * and nowhere else: redundant state changes, G_NOOP and G_SPNOOP are
+ * dropped, adjacent G_TRI1 are paired into G_TRI2, and everything left
+ * is moved up, so a list ends sooner; freed slots are zeroed in place,
+ * which makes them G_NOOP, and nothing after the end of a list is
+ * touched; G_RDPHALF_1 and the command after it, which reads it, are
+ * kept together as they are, as in G_TEXRECT's three commands
+ */
+static void dlgraphOptimizeRun(struct dlgraph *g, unsigned slot, unsigned slotEnd)
+{
+	unsigned char *run = g->room + slot * 8;
+	unsigned num = slotEnd - slot;
+	unsigned out = 0;
+	unsigned tri = ~0u;       /* output slot of an unpaired G_TRI1 */
+	unsigned i;
+	struct dlstate s;
+	
+	s.num = 0;
+	
+	for (i = 0; i < num; ++i)
+	{
+		unsigned char *b = run + i * 8;
+		int ends = *b == 0xdf || (*b == 0xde && b[1]);
+		
+		/* G_RDPHALF_1 */
+		if (*b == 0xe1)
+		{
+			unsigned n = i + 1 < num ? 2 : 1;
+			
+			memmove(run + out * 8, b, n * 8);
+			g->cmdNum += n;
+			g->cmdNumOptimized += n;
+			out += n;
+			i += n - 1;
+			tri = ~0u;
+			continue;
+		}
+		
+		/* G_NOOP, G_SPNOOP */
+		if (*b == 0x00 || *b == 0xe0)
+			continue;
+		
+		++g->cmdNum;
+		
+		if (dlstateSet(&s, b))
+		{
+			++g->stateDropped;
+			continue;
+		}
+		
+		/* G_TRI1, whose second word is always zero */
+		if (*b == 0x05 && !beU32(b + 4))
+		{
+			if (tri != ~0u)
+			{
+				unsigned char *t = run + tri * 8;
+				
+				t[0] = 0x06;
+				memcpy(t + 5, b + 1, 3);
+				tri = ~0u;
+				++g->triPaired;
+				continue;
+			}
+			tri = out;
+		}
+		else
+			tri = ~0u;
+		
+		if (out != i)
+			memcpy(run + out * 8, b, 8);
+		++out;
+		++g->cmdNumOptimized;
+		
+		/* anything past G_ENDDL or a branch is left alone */
+		if (ends)
+		{
+			memset(run + out * 8, 0, (i + 1 - out) * 8);
+			return;
+		}
+	}
+	
+	memset(run + out * 8, 0, (num - out) * 8);
+}
+
+/* optimize every converted display list, split into runs at each
+ * address something enters a list at
+ * returns non-zero if the room is left as it is
+ */
+static int dlgraphOptimize(struct dlgraph *g)
+{
+	unsigned i;
+	
+	/* G_BRANCH_Z and G_LOAD_UCODE take addresses in G_RDPHALF_1,
+	 * which could be anywhere; nothing is moved if there are any
+	 */
+	for (i = 0; i < g->unitNum; ++i)
+	{
+		unsigned char *b = g->room + g->unit[i].ofs;
+		unsigned char *end = b + g->unit[i].sz;
+		
+		for ( ; b < end; b += 8)
+		{
+			if (*b == 0x04 || *b == 0xdd)
+			{
+				fprintf(stderr, "display lists use G_BRANCH_Z or G_LOAD_UCODE, not optimizing\n");
+				return -1;
+			}
+		}
+	}
+	
+	for (i = 0; i < g->unitNum; ++i)
+	{
+		unsigned slot = g->unit[i].ofs / 8;
+		unsigned slotEnd = slot + g->unit[i].sz / 8;
+		unsigned k;
+		
+		for (k = slot + 1; k < slotEnd; ++k)
+		{
+			if (g->index[k])
+			{
+				dlgraphOptimizeRun(g, slot, k);
+				slot = k;
+			}
+		}
+		dlgraphOptimizeRun(g, slot, slotEnd);
+	}
+	
+	return 0;
+}
+
+void procMeshHeader0(struct dlgraph *g, unsigned char *head, unsigned headV)
+{
+	void *room = g->room;
+	unsigned roomSz = g->roomSz;
+	unsigned char *start;
+	unsigned char *end;
+	
+	if (!within(room, roomSz, head, 12))
+		return;
+	start = pointer(room, roomSz, head + 4);
+	end   = pointer(room, roomSz, head + 8);
+	
+	if (!start)
+		return;
+	
+	/* fixes issues in maps like death mountain crater */
+	if (end < start)
+	{
+		end = head;
+		wbeU32(head + 8, headV);
+	}
+	
+	/* entries running off the end of the room are ignored */
+	while (start < end && within(room, roomSz, start, 8))
+	{
+		void *dlist0 = pointer(room, roomSz, start + 0);
+		void *dlist1 = pointer(room, roomSz, start + 4);
+		
+		dlgraphRoot(g, dlist0);
+		dlgraphRoot(g, dlist1);
+		
+		start += 8; /* size of an entry */
+	}
+}
+
+void procMeshHeader1(struct dlgraph *g, unsigned char *head, unsigned headV)
+{
+	void *room = g->room;
+	unsigned roomSz = g->roomSz;
+	unsigned char *start = pointer(room, roomSz, head + 4);
+	
+	/* the list ends at a null entry, or else the end of the room */
+	while (within(room, roomSz, start, 4) && beU32(start))
+	{
+		void *dlist0 = pointer(room, roomSz, start);
+		
+		dlgraphRoot(g, dlist0);
+		
+		start += 4; /* size of an entry */
+	}
+	
+	(void)headV; /* -Wunused-parameter */
+}
+
+void procMeshHeader2(struct dlgraph *g, unsigned char *head, unsigned headV)
+{
+	void *room = g->room;
+	unsigned roomSz = g->roomSz;
+	unsigned char *start;
+	unsigned char *end;
+	
+	if (!within(room, roomSz, head, 12))
+		return;
+	start = pointer(room, roomSz, head + 4);
+	end   = pointer(room, roomSz, head + 8);
+	
+	if (!start)
+		return;
+	
+	/* fixes issues in maps like death mountain crater */
+	if (end < start)
+	{
+		end = head;
+		wbeU32(head + 8, headV);
+	}
+	
+	/* entries running off the end of the room are ignored */
+	while (start < end && within(room, roomSz, start, 16))
+	{
+		void *dlist0 = pointer(room, roomSz, start +  8);
+		void *dlist1 = pointer(room, roomSz, start + 12);
+		
+		dlgraphRoot(g, dlist0);
+		dlgraphRoot(g, dlist1);
+		
+		start += 16; /* size of an entry */
+	}
+}
+
+int roomconv(void *room, unsigned roomSz, int flags)
+{
+	struct dlgraph g = {0};
+	unsigned char *b;
+	unsigned char *end = (unsigned char*)room + (roomSz & ~7);
+	unsigned char *meshHeader;
+	unsigned meshHeaderV;
+	double start = statsNow();
+	int rval = -1;
+	
+	/* gfxdis and gfxasm are only built for the default pair */
+	if ((flags & (ROOMCONV_REFERENCE | ROOMCONV_BATCH))
+		&& strcmp(pair()->name, UCODE_DEFAULT)
+	)
+	{
+		fprintf(stderr, "the external converter only handles " UCODE_DEFAULT "\n");
+		return -1;
+	}
+	
+	/* nothing is read past the end of the room, even if its header
+	 * is missing its end command
+	 */
+	for (b = room; b < end && *b != 0x14; b += 8)
+	{
+		/* eliminate alternate headers */
+		if (*b == 0x18)
+			*b = 0x1f;
+		
+		/* eliminate room behavior (lost woods = too hot) */
+		if (*b == 0x08)
+			*b = 0x1f;
+	}
+	
+	for (b = room; b < end && *b != 0x14; b += 8)
+	{
+		if (*b == 0x0A)
+			break;
+	}
+	
+	if (b >= end || *b != 0x0A)
+		return -1;
+	
+	meshHeaderV = beU32(b + 4);
+	meshHeader = pointer(room, roomSz, b + 4);
+	
+	if (!within(room, roomSz, meshHeader, 8))
+	{
+		fprintf(stderr, "invalid mesh header pointer 0x%08x\n", meshHeaderV);
+		return -1;
+	}
+	
+	g.room = room;
+	g.roomSz = roomSz;
+	g.flags = flags;
+	g.dl = pair()->dl;
+	g.enddl = pair()->enddl;
+	g.index = calloc(roomSz / 8 + 1, sizeof(*g.index));
+	g.done = calloc(roomSz / 8 + 1, sizeof(*g.done));
+	if (!g.index || !g.done)
+		goto cleanup;
+	
+	switch (*meshHeader)
+	{
+		case 0x00:
+			procMeshHeader0(&g, meshHeader, meshHeaderV);
+			break;
+		
+		case 0x01:
+			procMeshHeader1(&g, meshHeader, meshHeaderV);
+			break;
+		
+		case 0x02:
+			procMeshHeader2(&g, meshHeader, meshHeaderV);
+			break;
+		
+		default:
+			fprintf(stderr, "unsupported mesh header format 0x%02x\n", *meshHeader);
+			goto cleanup;
+	}
+	
+	statsSpan("roomconv", start, "walk %u display lists", g.nodeNum);
+	
+	start = statsNow();
+	if (dlgraphConvert(&g))
+		goto cleanup;
+	statsSpan("roomconv", start, "translate %u bytes", g.unitBytes);
+	statsAdd(STAT_DLISTS, g.nodeNum);
+	statsAdd(STAT_DLIST_BYTES, g.unitBytes);
+	
+	if (flags & ROOMCONV_OPTIMIZE)
+	{
+		start = statsNow();
+		if (dlgraphOptimize(&g))
+			statsAdd(STAT_UNOPTIMIZED, 1);
+		else
+			fprintf(stderr
+				, "%u display list commands, %u after optimizing (%u redundant state changes dropped, %u triangle pairs merged)\n"
+				, g.cmdNum
+				, g.cmdNumOptimized
+				, g.stateDropped
+				, g.triPaired
+			);
+		statsSpan("roomconv", start, "optimize %u commands", g.cmdNum);
+		statsAdd(STAT_COMMANDS, g.cmdNum);
+		statsAdd(STAT_COMMANDS_OPTIMIZED, g.cmdNumOptimized);
+	}
+	
+	fprintf(stderr
+		, "%u display lists, %u edges, %u cycles, %u redundant conversions skipped\n"
+		, g.nodeNum
+		, g.edgeNum
+		, g.cycleNum
+		, g.refNum + g.edgeNum - g.nodeNum
+	);
+	
+	rval = 0;
+cleanup:
+	free(g.index);
+	free(g.done);
+	free(g.node);
+	free(g.edge);
+	free(g.stack);
+	free(g.unit);
+	return rval;
+}
+
+void roomconvThreads(int num)
+{
+	gThreads = num < 1 ? 1 : num;
+}
+
+int roomconvUcode(const char *name)
+{
+	const struct ucodePair *p = ucodePairFind(name);
+	
+	if (!p)
+		return -1;
+	
+	gPair = p;
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * roomconv.h <z64.me>
+ *
+ * converts a room's microcode in memory, from f3dex to f3dex2 unless
+ * another pair of microcodes is selected
+ *
+ */
+
+#ifndef ROOMCONV_H_INCLUDED
+#define ROOMCONV_H_INCLUDED
+
+/* use external gfxdis/gfxasm instead of the built-in translator */
+#define ROOMCONV_REFERENCE (1 << 0)
+
+/* same as ROOMCONV_REFERENCE, but each tool runs once per room */
+#define ROOMCONV_BATCH     (1 << 1)
+
+/* after converting, drop redundant state changes, pair triangles, and
+ * move what's left up so each display list ends sooner
+ */
+#define ROOMCONV_OPTIMIZE  (1 << 2)
+
+/* non-zero if ROOMCONV_BATCH can be used, which needs a gfxdis that
+ * takes -n; finds out by converting a tiny batch, so call it once, at
+ * startup, and use ROOMCONV_REFERENCE instead if it can't
+ */
+int roomconvBatchSupported(void);
+
+/* bumped whenever what roomconv() outputs changes, so anything cached
+ * from an earlier version can be told apart
+ */
+#define ROOMCONV_REVISION 2
+
+/* converts room in place, where roomSz is its size in bytes
+ * flags is any combination of ROOMCONV_* flags
+ * returns 0 on success, non-zero on failure
+ */
+int roomconv(void *room, unsigned roomSz, int flags);
+
+/* sets how many threads roomconv() may use to convert the display
+ * lists of one large room; call before any conversion is in progress
+ */
+void roomconvThreads(int num);
+
+/* selects the microcodes roomconv() converts between by name, such as
+ * "f3d:f3dex2" (see ucode.h); call before any conversion is in progress
+ * returns 0 on success, non-zero if the pair isn't supported
+ */
+int roomconvUcode(const char *name);
+
+#endif /* ROOMCONV_H_INCLUDED */
@@ -0,0 +1,549 @@
+/*
+ * scan.c <z64.me>
+ *
+ * scene header discovery, shared by find-scenes and extract-scenes
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "scan.h"
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86
+#endif
+
+#define die(X) { fprintf(stderr, X"\n"); exit(EXIT_FAILURE); }
+
+const uint8_t endmarker[STRIDE] = { 0x14, 0, 0, 0, 0, 0, 0, 0};
+
+size_t scenesegment(size_t datSz, size_t scene, uint32_t addr)
+{
+	size_t dat = scene + (addr & 0xffffff);
+	
+	/* invalid segment pointer */
+	if ((addr >> 24) != 0x02)
+		return 0;
+	
+	/* out of bounds */
+	if (dat >= datSz)
+		return 0;
+	
+	return dat;
+}
+
+/* byte outside the window; room lists can be up to 16 MiB from their
+ * scene header, so streamed input is read at random there
+ */
+static uint8_t peekfar(struct scan *s, size_t ofs)
+{
+	if (ofs - s->pageOfs >= s->pageLen)
+	{
+		ssize_t got = -1;
+		
+		s->pageOfs = ofs & ~(sizeof(s->page) - 1);
+		if (s->fd >= 0)
+			got = pread(s->fd, s->page, sizeof(s->page), s->pageOfs);
+		s->pageLen = got < 0 ? 0 : got;
+		
+		if (ofs - s->pageOfs >= s->pageLen)
+			return 0;
+	}
+	
+	return s->page[ofs - s->pageOfs];
+}
+
+/* byte as the scan sees it; claimed bytes read as zero */
+static inline uint8_t peek(struct scan *s, size_t ofs)
+{
+	if (s->claims.num && claimsFind(&s->claims, ofs))
+		return 0;
+	
+	if (ofs - s->winOfs < s->winLen)
+		return s->win[ofs - s->winOfs];
+	
+	return peekfar(s, ofs);
+}
+
+uint8_t scanPeek(struct scan *s, size_t ofs)
+{
+	return peek(s, ofs);
+}
+
+/* big-endian u32 as the scan sees it */
+static uint32_t peekbeu32(struct scan *s, size_t ofs)
+{
+	return ((uint32_t)peek(s, ofs) << 24)
+		| (peek(s, ofs + 1) << 16)
+		| (peek(s, ofs + 2) << 8)
+		| peek(s, ofs + 3)
+	;
+}
+
+/* claim bytes [lo, hi) for the scene at owner, so later matches ignore them */
+static void claim(struct scan *s, size_t lo, size_t hi, size_t owner)
+{
+	if (lo >= hi)
+		return;
+	
+	/* only ever used on writable, entirely in-memory input */
+	if (s->zero)
+		memset(s->win + lo, 0, hi - lo);
+	else if (claimsAdd(&s->claims, lo, hi, owner))
+		die("failed to record claimed range");
+}
+
+void scanInit(struct scan *s, uint8_t *datBegin, size_t datSz, FILE *out)
+{
+	memset(s, 0, sizeof(*s));
+	s->win = datBegin;
+	s->winLen = datSz;
+	s->datSz = datSz;
+	s->fd = -1;
+	s->out = out;
+	s->claims.report = stderr;
+}
+
+static uint8_t *findmarkerScalar(uint8_t *dat, uint8_t *datEnd)
+{
+	for ( ; dat + STRIDE <= datEnd; dat += STRIDE)
+		if (*dat == 0x14 && !memcmp(dat, endmarker, sizeof(endmarker)))
+			return dat;
+	
+	return dat;
+}
+
+#ifdef HAVE_X86
+/* 64 bytes per iteration; a command matches if both of its 32-bit
+ * halves equal those of the marker
+ */
+__attribute__((target("sse2")))
+static uint8_t *findmarkerSse2(uint8_t *dat, uint8_t *datEnd)
+{
+	const __m128i pat = _mm_set_epi32(0, 0x14, 0, 0x14);
+	
+	for ( ; dat + 64 <= datEnd; dat += 64)
+	{
+		__m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((void*)(dat +  0)), pat);
+		__m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((void*)(dat + 16)), pat);
+		__m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((void*)(dat + 32)), pat);
+		__m128i d = _mm_cmpeq_epi32(_mm_loadu_si128((void*)(dat + 48)), pat);
+		unsigned m = _mm_movemask_ps(_mm_castsi128_ps(a))
+			| _mm_movemask_ps(_mm_castsi128_ps(b)) << 4
+			| _mm_movemask_ps(_mm_castsi128_ps(c)) << 8
+			| _mm_movemask_ps(_mm_castsi128_ps(d)) << 12
+		;
+		
+		/* one bit per command whose halves both matched */
+		m &= (m >> 1) & 0x5555;
+		if (m)
+			return dat + __builtin_ctz(m) / 2 * STRIDE;
+	}
+	
+	return findmarkerScalar(dat, datEnd);
+}
+
+/* 64 bytes per iteration, one 64-bit lane per command */
+__attribute__((target("avx2")))
+static uint8_t *findmarkerAvx2(uint8_t *dat, uint8_t *datEnd)
+{
+	const __m256i pat = _mm256_set1_epi64x(0x14);
+	
+	for ( ; dat + 64 <= datEnd; dat += 64)
+	{
+		__m256i a = _mm256_cmpeq_epi64(_mm256_loadu_si256((void*)(dat +  0)), pat);
+		__m256i b = _mm256_cmpeq_epi64(_mm256_loadu_si256((void*)(dat + 32)), pat);
+		unsigned m = _mm256_movemask_pd(_mm256_castsi256_pd(a))
+			| _mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4
+		;
+		
+		if (m)
+			return dat + __builtin_ctz(m) * STRIDE;
+	}
+	
+	return findmarkerScalar(dat, datEnd);
+}
+#endif
+
+/* the end marker is little-endian 0x14 when read as a u64 */
+static int littleEndian(void)
+{
+	const uint16_t v = 1;
+	
+	return *(const uint8_t*)&v;
+}
+
+findmarker_t *findmarkerSelect(const char **name)
+{
+	const char *unused;
+	
+	if (!name)
+		name = &unused;
+
+#ifdef HAVE_X86
+	if (littleEndian())
+	{
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+		{
+			*name = "avx2";
+			return findmarkerAvx2;
+		}
+		if (__builtin_cpu_supports("sse2"))
+		{
+			*name = "sse2";
+			return findmarkerSse2;
+		}
+	}
+#endif
+
+	*name = "scalar";
+	return findmarkerScalar;
+}
+
+findmarker_t *findmarkerKernel(int n, const char **name)
+{
+	struct {
+		const char *name;
+		findmarker_t *func;
+	} kernel[3];
+	int kernelNum = 0;
+	
+	kernel[kernelNum].name = "scalar";
+	kernel[kernelNum++].func = findmarkerScalar;
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		kernel[kernelNum].name = "sse2";
+		kernel[kernelNum++].func = findmarkerSse2;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		kernel[kernelNum].name = "avx2";
+		kernel[kernelNum++].func = findmarkerAvx2;
+	}
+#endif
+
+	if (n < 0 || n >= kernelNum)
+		return 0;
+	
+	if (name)
+		*name = kernel[n].name;
+	return kernel[n].func;
+}
+
+/* prints a scene and its rooms, either as they have always been
+ * printed or tab-separated if the input is named
+ */
+static void report(struct scan *s, const struct found *f)
+{
+	unsigned datAddr = (unsigned)f->scene;
+	unsigned i;
+	
+	/* print file address of potential scene header */
+	if (s->name)
+		fprintf(s->out, "scene\t%s\t%08X\t%u\n", s->name, datAddr, f->roomNum);
+	else
+		fprintf(s->out, "%08X\n", datAddr);
+	
+	/* list start address of each room referenced by scene */
+	for (i = 0; i < f->roomValid; ++i)
+	{
+		if (s->name)
+			fprintf(s->out, "room\t%s\t%08X\t%u\t%08X\t%u\n"
+				, s->name, datAddr, i, f->room[i].begin
+				, f->room[i].end - f->room[i].begin
+			);
+		else
+			fprintf(s->out, " -> %08X\n", f->room[i].begin);
+	}
+	
+	/* the room list stopped at an invalid room address */
+	if (i < f->roomNum)
+	{
+		if (s->name)
+			fprintf(s->out, "room\t%s\t%08X\t%u\tERROR\t-\n", s->name, datAddr, i);
+		else
+			fprintf(s->out, " -> ERROR\n");
+	}
+}
+
+void scanCheck(struct scan *s, size_t dat)
+{
+	struct found f;
+	size_t datSz = s->datSz;
+	size_t bounds = dat > 32 * STRIDE ? dat - 32 * STRIDE : 0;
+	size_t roomlist = 0;
+	size_t scene = 0;
+	size_t sceneEnd = 0;
+	size_t walk;
+	uint8_t roomnum = 0;
+	uint8_t i;
+	unsigned datAddr;
+	
+	/* walk backwards for a max of 32 unique header commands
+	 * to confirm whether the structure matches what's typical
+	 */
+	for (walk = dat; walk > bounds; walk -= STRIDE)
+	{
+		switch (peek(s, walk))
+		{
+			case 0x04:
+				roomlist = walk + 4;
+				roomnum = peek(s, walk + 1);
+				scene = walk; /* some scenes begin with this command */
+				break;
+			
+			/* some scenes actually lack these commands */
+			case 0x15:
+			case 0x18:
+				scene = walk;
+				break;
+		}
+	}
+	
+	++s->markerNum;
+	
+	/* missing start command, so not a scene */
+	if (!scene)
+	{
+		++s->reject[SCAN_NOSTART];
+		return;
+	}
+	
+	/* not 64-bit aligned, so not a scene */
+	datAddr = (unsigned)scene;
+	if (datAddr & 0xf)
+	{
+		++s->reject[SCAN_MISALIGNED];
+		return;
+	}
+	
+	/* no room list */
+	if (roomnum == 0)
+	{
+		++s->reject[SCAN_NOROOMS];
+		return;
+	}
+	
+	/* invalid room list pointer */
+	if (!(roomlist = scenesegment(datSz, scene, peekbeu32(s, roomlist))))
+	{
+		++s->reject[SCAN_ROOMLIST];
+		return;
+	}
+	
+	f.scene = datAddr;
+	f.roomNum = roomnum;
+	++s->sceneNum;
+	
+	/* walk room list */
+	for (i = 0; i < roomnum; ++i)
+	{
+		size_t this = roomlist + i * sizeof(uint32_t) * 2;
+		uint32_t begin = peekbeu32(s, this);
+		uint32_t end = peekbeu32(s, this + sizeof(uint32_t));
+		
+		/* invalid room address conditions */
+		if (begin > end
+			|| begin >= datSz
+			|| end >= datSz
+		)
+			break;
+		
+		f.room[i].begin = begin;
+		f.room[i].end = end;
+		
+		/* claim each room file's contents so its header is ignored */
+		claim(s, begin, end, datAddr);
+		
+		/* files are packed such that the end of the scene
+		 * happens to be the same address as the beginning
+		 * of the first room
+		 */
+		if (i == 0)
+			sceneEnd = begin;
+	}
+	f.roomValid = i;
+	
+	/* it made it through the entire room list without a problem,
+	 * so that data appears to be correct; now claim the scene
+	 * file's contents in case it contains alternate headers
+	 */
+	if (i == roomnum && sceneEnd > scene)
+		claim(s, scene, sceneEnd, datAddr);
+	
+	if (s->found)
+		s->found(s, &f);
+	else
+		report(s, &f);
+}
+
+/* checks the slots in [from, to) that only read as an end marker
+ * because a claim starting partway through one zeroes its tail; the
+ * raw bytes aren't a marker, so findmarker() never sees them
+ */
+static void scanPartial(struct scan *s, size_t from, size_t to)
+{
+	const struct claim *c;
+	size_t ofs = from;
+	
+	while ((c = claimsFirst(&s->claims, ofs)) && c->lo < to)
+	{
+		size_t slot = c->lo & ~(size_t)(STRIDE - 1);
+		int k;
+		
+		ofs = c->hi;
+		if (slot == c->lo
+			|| slot < from
+			|| slot + STRIDE > to
+			|| !memcmp(s->win + (slot - s->winOfs), endmarker, STRIDE)
+		)
+			continue;
+		
+		for (k = 0; k < STRIDE; ++k)
+			if (peek(s, slot + k) != endmarker[k])
+				break;
+		if (k == STRIDE)
+			scanCheck(s, slot);
+	}
+}
+
+size_t scanRange(struct scan *s, size_t from, size_t to)
+{
+	findmarker_t *findmarker = findmarkerSelect(0);
+	uint8_t *end = s->win + (to - s->winOfs);
+	uint8_t *dat;
+	
+	s->scanned += to - from;
+	
+	/* visit each potential scene header end marker match */
+	for (dat = findmarker(s->win + (from - s->winOfs), end)
+		; dat + STRIDE <= end
+		; dat = findmarker(dat + STRIDE, end)
+	)
+	{
+		size_t ofs = s->winOfs + (dat - s->win);
+		const struct claim *c;
+		
+		/* anything between here and the last candidate comes first */
+		if (s->claims.num)
+			scanPartial(s, from, ofs);
+		from = ofs + STRIDE;
+		c = claimsFind(&s->claims, ofs);
+		
+		/* jump over claimed regions; they read as zeroes */
+		if (c)
+		{
+			size_t next = (c->hi + STRIDE - 1) & ~(size_t)(STRIDE - 1);
+			
+			++s->markerNum;
+			++s->reject[SCAN_CLAIMED];
+			if (next >= to)
+				return next;
+			dat = s->win + (next - s->winOfs) - STRIDE;
+			from = next;
+			continue;
+		}
+		
+		scanCheck(s, ofs);
+	}
+	
+	if (s->claims.num && from < to)
+		scanPartial(s, from, to);
+	
+	return s->winOfs + (dat - s->win);
+}
+
+void scanAll(struct scan *s)
+{
+	scanRange(s, 0, s->datSz);
+}
+
+void scanStats(const struct scan *s)
+{
+	statsAdd(STAT_SCANNED, s->scanned);
+	statsAdd(STAT_MARKERS, s->markerNum);
+	statsAdd(STAT_NOSTART, s->reject[SCAN_NOSTART]);
+	statsAdd(STAT_MISALIGNED, s->reject[SCAN_MISALIGNED]);
+	statsAdd(STAT_NOROOMS, s->reject[SCAN_NOROOMS]);
+	statsAdd(STAT_ROOMLIST, s->reject[SCAN_ROOMLIST]);
+	statsAdd(STAT_CLAIMED, s->reject[SCAN_CLAIMED]);
+	statsAdd(STAT_SCENES, s->sceneNum);
+}
+
+/* size of the window streamed input is scanned through */
+#define WINDOW (16 << 20)
+
+/* bytes kept from the previous window, enough for the backward walk */
+#define LOOKBACK (32 * STRIDE)
+
+int scanStream(struct scan *ss, int fd)
+{
+	struct scan s = *ss;
+	struct stat st;
+	uint8_t *buf;
+	size_t next = 0;
+	int rval;
+	
+	if (fstat(fd, &st) || !(buf = malloc(LOOKBACK + WINDOW)))
+		return -1;
+	
+	s.win = buf;
+	s.winOfs = 0;
+	s.winLen = 0;
+	s.datSz = st.st_size;
+	s.fd = fd;
+	
+	for (;;)
+	{
+		size_t want;
+		ssize_t got = 0;
+		
+		/* slide the window, keeping the tail for the backward walk */
+		if (s.winLen > LOOKBACK)
+		{
+			memmove(buf, buf + s.winLen - LOOKBACK, LOOKBACK);
+			s.winOfs += s.winLen - LOOKBACK;
+			s.winLen = LOOKBACK;
+		}
+		
+		/* fill the rest of it */
+		for (want = LOOKBACK + WINDOW - s.winLen; want; want -= got)
+		{
+			got = pread(fd, buf + s.winLen, want, s.winOfs + s.winLen);
+			if (got <= 0)
+				break;
+			s.winLen += got;
+		}
+		if (got < 0)
+			break;
+		
+		if (next < s.winOfs + s.winLen)
+			next = scanRange(&s, next < s.winOfs ? s.winOfs : next, s.winOfs + s.winLen);
+		
+		/* end of input */
+		if (!got)
+			break;
+	}
+	
+	/* anything short of the whole input is a read error */
+	rval = s.winOfs + s.winLen != s.datSz;
+	
+	free(buf);
+	s.win = 0;
+	s.winOfs = 0;
+	s.winLen = 0;
+	s.fd = -1;
+	*ss = s;
+	
+	return rval;
+}
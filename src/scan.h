@@ -0,0 +1,117 @@
+/*
+ * scan.h <z64.me>
+ *
+ * scene header discovery, shared by find-scenes and extract-scenes
+ *
+ */
+
+#ifndef SCAN_H_INCLUDED
+#define SCAN_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "claims.h"
+
+#define STRIDE 8 /* length of a header command */
+
+/* a scene header ends with this command */
+extern const uint8_t endmarker[STRIDE];
+
+/* a scene header located by a scan */
+struct found {
+	size_t scene;           /* input offset of the header */
+	unsigned roomNum;       /* rooms in its room list */
+	unsigned roomValid;     /* leading rooms whose addresses are sane */
+	struct {
+		uint32_t begin;
+		uint32_t end;
+	} room[256];
+};
+
+/* reasons a candidate end marker turns out not to end a scene header */
+enum scanReject {
+	SCAN_NOSTART,           /* no command that starts a header */
+	SCAN_MISALIGNED,        /* header isn't 16-byte aligned */
+	SCAN_NOROOMS,           /* no room list, or an empty one */
+	SCAN_ROOMLIST,          /* room list pointer is invalid */
+	SCAN_CLAIMED,           /* inside a scene or room already found */
+	SCAN_REJECT_NUM
+};
+
+/* state of one scan over an input, which is either entirely in memory
+ * or streamed through a fixed-size window; everything is addressed by
+ * input offset
+ */
+struct scan {
+	uint8_t *win;           /* input bytes, or a window into them */
+	size_t winOfs;          /* input offset of win[0] */
+	size_t winLen;          /* bytes in win */
+	size_t datSz;           /* size of entire input */
+	int fd;                 /* streamed input, for reads outside the window */
+	uint8_t page[4096];     /* most recent read outside the window */
+	size_t pageOfs;
+	size_t pageLen;
+	struct claims claims;   /* scenes and rooms found so far */
+	FILE *out;              /* findings are printed here */
+	const char *name;       /* input name, if findings are tab-separated */
+	size_t sceneNum;        /* number of scenes found */
+	size_t scanned;         /* bytes searched for end markers */
+	size_t markerNum;       /* candidate end markers */
+	size_t reject[SCAN_REJECT_NUM]; /* candidates that weren't scenes */
+	int zero;               /* zero claimed bytes instead, like before */
+	void (*found)(struct scan *s, const struct found *f); /* instead of printing */
+	void *udata;            /* for use by found() */
+};
+
+/* end marker search kernels; each returns the first command at or
+ * after dat (stepping STRIDE bytes at a time) matching the end marker,
+ * or a pointer at or past the last whole command if there is none
+ */
+typedef uint8_t *findmarker_t(uint8_t *dat, uint8_t *datEnd);
+
+/* picks the fastest kernel the cpu supports */
+findmarker_t *findmarkerSelect(const char **name);
+
+/* returns the nth kernel the cpu supports, slowest first, or 0 if
+ * there are no more; for benchmarking
+ */
+findmarker_t *findmarkerKernel(int n, const char **name);
+
+/* retrieve offset of data pointed to by a scene segment address
+ * returns 0 if out of bounds or if invalid segment pointer
+ */
+size_t scenesegment(size_t datSz, size_t scene, uint32_t addr);
+
+/* prepare a scan over a buffer holding the entire input */
+void scanInit(struct scan *s, uint8_t *datBegin, size_t datSz, FILE *out);
+
+/* byte as the scan sees it; claimed bytes read as zero */
+uint8_t scanPeek(struct scan *s, size_t ofs);
+
+/* checks whether the end marker at dat concludes a scene header; if it
+ * does, reports the scene and its rooms, then claims them so their
+ * headers are ignored by later matches
+ */
+void scanCheck(struct scan *s, size_t dat);
+
+/* scans the commands in [from, to), which lie within the window
+ * returns the offset at which scanning should resume
+ */
+size_t scanRange(struct scan *s, size_t from, size_t to);
+
+/* serial scan of an input held entirely in memory */
+void scanAll(struct scan *s);
+
+/* scans input read through a fixed-size window instead of being loaded,
+ * so memory use stays flat no matter how large the input is; anything
+ * outside the window is read at random
+ * returns 0 on success, non-zero on failure
+ */
+int scanStream(struct scan *s, int fd);
+
+/* adds a scan's counters to the run's --stats totals */
+void scanStats(const struct scan *s);
+
+#endif /* SCAN_H_INCLUDED */
@@ -0,0 +1,397 @@
+/*
+ * sigscan.c <z64.me>
+ *
+ * finds every kind of structure worth a look (scenes, rooms, mesh
+ * headers, display lists) in a single sweep over a dump
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sigscan.h"
+
+#define STRIDE 8 /* length of a command */
+
+/* header commands walked back over from an end marker, at most */
+#define HEADER_MAX 32
+
+/* display list commands walked back over from an end marker, at most */
+#define DLIST_MAX 4096
+
+/* what each opcode is the signature of; the sweep does one lookup per
+ * command no matter how many kinds of structure there are, and only
+ * looks closer at commands whose opcode can begin or end one
+ */
+#define CHECK_MESH   1 /* mesh header type */
+#define CHECK_HEADER 2 /* scene and room header end marker */
+#define CHECK_DLIST  3 /* display list end */
+static const uint8_t check[256] = {
+	[0x00] = CHECK_MESH,
+	[0x01] = CHECK_MESH,
+	[0x02] = CHECK_MESH,
+	[0x14] = CHECK_HEADER,
+	[0xB8] = CHECK_DLIST,
+	[0xDF] = CHECK_DLIST,
+};
+
+/* opcodes a display list may contain, per microcode */
+static const uint8_t f3dexOp[256] = {
+	[0x01] = 1, [0x03] = 1, [0x04] = 1, [0x06] = 1,
+	[0xAF ... 0xB7] = 1, [0xB9 ... 0xC0] = 1,
+	[0xE4 ... 0xFF] = 1,
+};
+static const uint8_t f3dex2Op[256] = {
+	[0x00 ... 0x08] = 1,
+	[0xD3 ... 0xDE] = 1,
+	[0xE0 ... 0xFF] = 1,
+};
+
+/* the state of a sweep */
+struct sweep {
+	const uint8_t *dat;
+	size_t datSz;
+	struct candidates *c;
+	size_t *roomRef;        /* rooms that scenes' room lists point to */
+	size_t roomRefNum;
+	size_t roomRefCap;
+	size_t *meshRef;        /* mesh headers that room headers point to */
+	size_t meshRefNum;
+	size_t meshRefCap;
+	int fail;
+};
+
+/* big-endian u32 */
+static uint32_t rbeu32(const uint8_t *b)
+{
+	return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* non-zero if a command is entirely zero, i.e. padding */
+static int padding(const uint8_t *b)
+{
+	return !(b[0] | b[1] | b[2] | b[3] | b[4] | b[5] | b[6] | b[7]);
+}
+
+/* append to a growable list of offsets */
+static void reference(struct sweep *w, size_t **list, size_t *num, size_t *cap, size_t ofs)
+{
+	if (*num == *cap)
+	{
+		size_t n = *cap ? *cap * 2 : 64;
+		void *tmp = realloc(*list, n * sizeof(**list));
+		
+		if (!tmp)
+		{
+			w->fail = 1;
+			return;
+		}
+		*list = tmp;
+		*cap = n;
+	}
+	
+	(*list)[(*num)++] = ofs;
+}
+
+/* record a candidate */
+static void candidate(struct sweep *w, size_t ofs, size_t sz, int kind, int confidence, unsigned detail)
+{
+	struct candidates *c = w->c;
+	struct candidate *cand;
+	
+	if (c->num == c->cap)
+	{
+		size_t cap = c->cap ? c->cap * 2 : 256;
+		void *tmp = realloc(c->cand, cap * sizeof(*c->cand));
+		
+		if (!tmp)
+		{
+			w->fail = 1;
+			return;
+		}
+		c->cand = tmp;
+		c->cap = cap;
+	}
+	
+	cand = c->cand + c->num++;
+	cand->ofs = ofs;
+	cand->sz = sz;
+	cand->kind = kind;
+	cand->confidence = confidence;
+	cand->detail = detail;
+}
+
+/* a mesh header's type, and what else about it is consistent with that;
+ * types 0 and 2 give the start and end of their entries, which are 8 and
+ * 16 bytes each, and type 1 has a format of 1 or 2
+ * returns confidence, or 0 if it isn't a mesh header
+ */
+static int meshConfidence(const uint8_t *dat, size_t datSz, size_t ofs)
+{
+	const uint8_t *b = dat + ofs;
+	
+	if (ofs + 12 > datSz || b[2] || b[3] || b[4] != 0x03)
+		return 0;
+	
+	switch (b[0])
+	{
+		case 0x00:
+		case 0x02:
+			if (b[1]
+				&& b[8] == 0x03
+				&& rbeu32(b + 8) - rbeu32(b + 4) == b[1] * (b[0] ? 16u : 8u)
+			)
+				return 80;
+			break;
+		
+		case 0x01:
+			if (b[1] == 1 || b[1] == 2)
+				return 40;
+			break;
+	}
+	
+	return 0;
+}
+
+/* a mesh header whose signature begins a command */
+static void checkMesh(struct sweep *w, size_t ofs)
+{
+	int confidence = meshConfidence(w->dat, w->datSz, ofs);
+	
+	if (confidence)
+		candidate(w, ofs, w->dat[ofs] == 0x01 ? 8 : 12, SIG_MESH, confidence, w->dat[ofs]);
+}
+
+/* a scene or room header concluded by the end marker at end; its
+ * commands are walked back over until something that isn't one
+ */
+static void checkHeader(struct sweep *w, size_t end)
+{
+	const uint8_t *dat = w->dat;
+	const uint8_t *b = dat + end;
+	const uint8_t *roomList = 0;
+	const uint8_t *mesh = 0;
+	size_t start;
+	int confidence = 40;
+	
+	if (b[1] | b[2] | b[3] | b[4] | b[5] | b[6] | b[7])
+		return;
+	
+	for (start = end
+		; start >= STRIDE && end - start < HEADER_MAX * STRIDE
+		; start -= STRIDE
+	)
+	{
+		b = dat + start - STRIDE;
+		
+		if (*b >= 0x20 || *b == 0x14 || padding(b))
+			break;
+		
+		if (*b == 0x04 && b[4] == 0x02)
+			roomList = b;
+		else if (*b == 0x0A && b[4] == 0x03)
+			mesh = b;
+	}
+	
+	/* files are 16-byte aligned */
+	if (!(start & 0xf))
+		confidence += 20;
+	
+	/* scenes have room lists */
+	if (roomList)
+	{
+		size_t list = start + (rbeu32(roomList + 4) & 0xffffff);
+		unsigned roomNum = roomList[1];
+		unsigned i;
+		
+		if (roomNum && list + roomNum * 8 <= w->datSz)
+		{
+			for (i = 0; i < roomNum; ++i)
+			{
+				uint32_t lo = rbeu32(dat + list + i * 8);
+				uint32_t hi = rbeu32(dat + list + i * 8 + 4);
+				
+				if (lo > hi || hi > w->datSz)
+					break;
+			}
+			
+			/* every room is in bounds, so they are worth pointing to */
+			if (i == roomNum)
+			{
+				confidence += 30;
+				for (i = 0; i < roomNum; ++i)
+					reference(w, &w->roomRef, &w->roomRefNum, &w->roomRefCap, rbeu32(dat + list + i * 8));
+				
+				/* and the scene ends where its first room begins */
+				if (rbeu32(dat + list) >= end + STRIDE)
+					confidence += 10;
+			}
+		}
+		
+		candidate(w, start, end + STRIDE - start, SIG_SCENE, confidence, roomNum);
+	}
+	
+	/* rooms have mesh headers, at offsets relative to the room */
+	else if (mesh)
+	{
+		size_t at = start + (rbeu32(mesh + 4) & 0xffffff);
+		unsigned type = 0xff;
+		
+		if (meshConfidence(dat, w->datSz, at))
+		{
+			confidence += 30;
+			type = dat[at];
+			reference(w, &w->meshRef, &w->meshRefNum, &w->meshRefCap, at);
+		}
+		
+		/* an orphan until a scene turns out to point to it */
+		candidate(w, start, end + STRIDE - start, SIG_ORPHAN_ROOM, confidence, type);
+	}
+}
+
+/* a display list ending at end, walked back over while its commands
+ * belong to the same microcode as its end marker
+ */
+static void checkDlist(struct sweep *w, size_t end)
+{
+	const uint8_t *dat = w->dat;
+	const uint8_t *b = dat + end;
+	const uint8_t *op = *b == 0xB8 ? f3dexOp : f3dex2Op;
+	int kind = *b == 0xB8 ? SIG_DLIST_F3DEX : SIG_DLIST_F3DEX2;
+	size_t start;
+	unsigned num;
+	
+	if (b[1] | b[2] | b[3] | b[4] | b[5] | b[6] | b[7])
+		return;
+	
+	for (start = end
+		; start >= STRIDE && end - start < DLIST_MAX * STRIDE
+		; start -= STRIDE
+	)
+	{
+		b = dat + start - STRIDE;
+		
+		if (!op[*b] || padding(b))
+			break;
+	}
+	
+	/* a lone end marker is more likely to be a coincidence */
+	num = (end - start) / STRIDE;
+	if (!num)
+		return;
+	
+	candidate(w, start, end + STRIDE - start, kind, 30 + (num < 10 ? num * 7 : 70), num + 1);
+}
+
+/* ascending offsets */
+static int compareOfs(const void *a, const void *b)
+{
+	size_t x = *(const size_t*)a;
+	size_t y = *(const size_t*)b;
+	
+	return (x > y) - (x < y);
+}
+
+/* ascending offsets, then kinds */
+static int compareCandidate(const void *a, const void *b)
+{
+	const struct candidate *x = a;
+	const struct candidate *y = b;
+	
+	if (x->ofs != y->ofs)
+		return (x->ofs > y->ofs) - (x->ofs < y->ofs);
+	
+	return x->kind - y->kind;
+}
+
+/* non-zero if a sorted list contains ofs */
+static int contains(const size_t *list, size_t num, size_t ofs)
+{
+	return num && bsearch(&ofs, list, num, sizeof(*list), compareOfs);
+}
+
+const char *sigscanKind(int kind)
+{
+	switch (kind)
+	{
+		case SIG_SCENE: return "scene";
+		case SIG_ROOM: return "room";
+		case SIG_ORPHAN_ROOM: return "orphan-room";
+		case SIG_MESH: return "mesh";
+		case SIG_DLIST_F3DEX: return "dlist-f3dex";
+		case SIG_DLIST_F3DEX2: return "dlist-f3dex2";
+	}
+	
+	return "unknown";
+}
+
+int sigscan(const uint8_t *dat, size_t datSz, struct candidates *c)
+{
+	struct sweep w = {0};
+	size_t i;
+	
+	w.dat = dat;
+	w.datSz = datSz;
+	w.c = c;
+	
+	for (i = 0; i + STRIDE <= datSz && !w.fail; i += STRIDE)
+	{
+		switch (check[dat[i]])
+		{
+			case CHECK_MESH:
+				checkMesh(&w, i);
+				break;
+			
+			case CHECK_HEADER:
+				checkHeader(&w, i);
+				break;
+			
+			case CHECK_DLIST:
+				checkDlist(&w, i);
+				break;
+		}
+	}
+	
+	/* backward walks make candidates that begin before earlier ones */
+	qsort(c->cand, c->num, sizeof(*c->cand), compareCandidate);
+	qsort(w.roomRef, w.roomRefNum, sizeof(*w.roomRef), compareOfs);
+	qsort(w.meshRef, w.meshRefNum, sizeof(*w.meshRef), compareOfs);
+	
+	/* being pointed to by another candidate is worth some confidence */
+	for (i = 0; i < c->num && !w.fail; ++i)
+	{
+		struct candidate *cand = c->cand + i;
+		
+		if (cand->kind == SIG_ORPHAN_ROOM
+			&& contains(w.roomRef, w.roomRefNum, cand->ofs)
+		)
+		{
+			cand->kind = SIG_ROOM;
+			cand->confidence += 10;
+		}
+		else if (cand->kind == SIG_MESH
+			&& contains(w.meshRef, w.meshRefNum, cand->ofs)
+		)
+			cand->confidence += 20;
+	}
+	
+	free(w.roomRef);
+	free(w.meshRef);
+	
+	if (w.fail)
+	{
+		sigscanFree(c);
+		return -1;
+	}
+	
+	return 0;
+}
+
+void sigscanFree(struct candidates *c)
+{
+	free(c->cand);
+	c->cand = 0;
+	c->num = 0;
+	c->cap = 0;
+}
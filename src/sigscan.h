@@ -0,0 +1,51 @@
+/*
+ * sigscan.h <z64.me>
+ *
+ * finds every kind of structure worth a look (scenes, rooms, mesh
+ * headers, display lists) in a single sweep over a dump
+ *
+ */
+
+#ifndef SIGSCAN_H_INCLUDED
+#define SIGSCAN_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* kinds of candidate */
+#define SIG_SCENE        0 /* scene header */
+#define SIG_ROOM         1 /* room header a scene's room list points to */
+#define SIG_ORPHAN_ROOM  2 /* room header no scene points to */
+#define SIG_MESH         3 /* mesh header, of type 0, 1 or 2 */
+#define SIG_DLIST_F3DEX  4 /* display list ending in 0xB8 */
+#define SIG_DLIST_F3DEX2 5 /* display list ending in 0xDF */
+
+/* a structure that might be at an offset */
+struct candidate {
+	size_t ofs;
+	size_t sz;              /* bytes recognised as belonging to it */
+	int kind;
+	int confidence;         /* 0 to 100 */
+	unsigned detail;        /* rooms, mesh header type, or commands */
+};
+
+/* candidates, sorted by offset */
+struct candidates {
+	struct candidate *cand;
+	size_t num;
+	size_t cap;
+};
+
+/* name of a kind of candidate */
+const char *sigscanKind(int kind);
+
+/* sweeps a dump once, collecting every candidate; unlike the scene scan,
+ * nothing is claimed, so structures nested in others are reported too
+ * returns 0 on success, non-zero on failure
+ */
+int sigscan(const uint8_t *dat, size_t datSz, struct candidates *c);
+
+/* releases a candidate list; it is left empty and can be reused */
+void sigscanFree(struct candidates *c);
+
+#endif /* SIGSCAN_H_INCLUDED */
@@ -0,0 +1,238 @@
+/*
+ * stats.c <z64.me>
+ *
+ * optional instrumentation shared by the tools: running counters, and
+ * timed spans that are reported with --stats or written as a chrome
+ * trace-event timeline with --trace
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+/* printed beside each counter */
+static const char *gStatName[STAT_NUM] = {
+	[STAT_SCANNED] = "bytes scanned",
+	[STAT_MARKERS] = "candidate end markers",
+	[STAT_NOSTART] = "rejected: no start command",
+	[STAT_MISALIGNED] = "rejected: misaligned",
+	[STAT_NOROOMS] = "rejected: no rooms",
+	[STAT_ROOMLIST] = "rejected: invalid room list pointer",
+	[STAT_CLAIMED] = "rejected: inside a scene or room already found",
+	[STAT_SCENES] = "scene headers found",
+	[STAT_RIPPED] = "scenes ripped",
+	[STAT_RIPS_CACHED] = "scenes restored from cache",
+	[STAT_ROOMS] = "rooms converted",
+	[STAT_ROOMS_CACHED] = "rooms restored from cache",
+	[STAT_DLISTS] = "display lists converted",
+	[STAT_DLIST_BYTES] = "display list bytes converted",
+	[STAT_COMMANDS] = "display list commands before optimizing",
+	[STAT_COMMANDS_OPTIMIZED] = "display list commands after optimizing",
+	[STAT_UNOPTIMIZED] = "rooms not optimized: G_BRANCH_Z or G_LOAD_UCODE",
+	[STAT_SUBPROCESSES] = "subprocesses run",
+	[STAT_SUBPROCESS_US] = "subprocess microseconds",
+	[STAT_READ] = "bytes read",
+	[STAT_WRITTEN] = "bytes written",
+};
+
+/* a complete event, in trace-event terms */
+struct span {
+	char *name;
+	const char *cat;
+	double start;           /* microseconds */
+	double dur;
+	int tid;
+};
+
+static unsigned long long gStat[STAT_NUM];
+static int gOn = 0;
+static int gReport = 0;
+static const char *gTrace = 0;
+static struct timespec gEpoch;
+static struct span *gSpan = 0;
+static size_t gSpanNum = 0;
+static size_t gSpanCap = 0;
+static pthread_mutex_t gSpanLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* threads are numbered in the order they first record a span */
+static __thread int tThread = 0;
+static int gThreadNum = 0;
+
+void statsBegin(int report, const char *trace)
+{
+	clock_gettime(CLOCK_MONOTONIC, &gEpoch);
+	gReport = report;
+	gTrace = trace;
+	gOn = report || trace;
+}
+
+int statsOn(void)
+{
+	return gOn;
+}
+
+double statsNow(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (ts.tv_sec - gEpoch.tv_sec) * 1e6 + (ts.tv_nsec - gEpoch.tv_nsec) / 1e3;
+}
+
+void statsAdd(enum statsCounter which, unsigned long long n)
+{
+	__atomic_fetch_add(gStat + which, n, __ATOMIC_RELAXED);
+}
+
+void statsSpan(const char *cat, double start, const char *fmt, ...)
+{
+	double end;
+	char name[256];
+	va_list ap;
+	
+	if (!gOn)
+		return;
+	
+	end = statsNow();
+	va_start(ap, fmt);
+	vsnprintf(name, sizeof(name), fmt, ap);
+	va_end(ap);
+	
+	if (!tThread)
+		tThread = __atomic_add_fetch(&gThreadNum, 1, __ATOMIC_RELAXED);
+	
+	pthread_mutex_lock(&gSpanLock);
+	if (gSpanNum == gSpanCap)
+	{
+		size_t cap = gSpanCap ? gSpanCap * 2 : 256;
+		void *tmp = realloc(gSpan, cap * sizeof(*gSpan));
+		
+		/* a span that can't be kept is dropped, nothing more */
+		if (!tmp)
+		{
+			pthread_mutex_unlock(&gSpanLock);
+			return;
+		}
+		gSpan = tmp;
+		gSpanCap = cap;
+	}
+	if ((gSpan[gSpanNum].name = strdup(name)))
+	{
+		gSpan[gSpanNum].cat = cat;
+		gSpan[gSpanNum].start = start;
+		gSpan[gSpanNum].dur = end - start;
+		gSpan[gSpanNum].tid = tThread;
+		++gSpanNum;
+	}
+	pthread_mutex_unlock(&gSpanLock);
+}
+
+/* for sorting spans by when they started */
+static int spanCompare(const void *a, const void *b)
+{
+	const struct span *x = a;
+	const struct span *y = b;
+	
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/* writes a string as json, escaping whatever needs it */
+static void jsonString(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for ( ; *str; ++str)
+	{
+		if (*str == '"' || *str == '\\')
+			fprintf(fp, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(fp, "\\u%04x", *str);
+		else
+			fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+/* writes every span, and the counters as they ended, as a trace that
+ * chrome://tracing and perfetto can open
+ * returns 0 on success, non-zero on failure
+ */
+static int writeTrace(const char *fn, double end)
+{
+	FILE *fp;
+	size_t i;
+	
+	if (!(fp = fopen(fn, "w")))
+		return -1;
+	
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (i = 0; i < gSpanNum; ++i)
+	{
+		struct span *s = gSpan + i;
+		
+		fprintf(fp, "{\"name\":");
+		jsonString(fp, s->name);
+		fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d},\n"
+			, s->cat, s->start, s->dur, s->tid
+		);
+	}
+	fprintf(fp, "{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{", end);
+	for (i = 0; i < STAT_NUM; ++i)
+	{
+		jsonString(fp, gStatName[i]);
+		fprintf(fp, ":%llu%s", gStat[i], i + 1 < STAT_NUM ? "," : "");
+	}
+	fprintf(fp, "}}\n],\"displayTimeUnit\":\"ms\"}\n");
+	
+	return fclose(fp) != 0;
+}
+
+int statsEnd(FILE *report)
+{
+	double end = statsNow();
+	size_t i;
+	int rval = 0;
+	
+	if (!gOn)
+		return 0;
+	
+	qsort(gSpan, gSpanNum, sizeof(*gSpan), spanCompare);
+	
+	if (gReport && report)
+	{
+		fprintf(report, "#span\tcategory\tthread\tstart-ms\tms\n");
+		for (i = 0; i < gSpanNum; ++i)
+			fprintf(report, "%s\t%s\t%d\t%.3f\t%.3f\n"
+				, gSpan[i].name
+				, gSpan[i].cat
+				, gSpan[i].tid
+				, gSpan[i].start / 1e3
+				, gSpan[i].dur / 1e3
+			);
+		fprintf(report, "#counter\tvalue\n");
+		for (i = 0; i < STAT_NUM; ++i)
+			fprintf(report, "%s\t%llu\n", gStatName[i], gStat[i]);
+		fprintf(report, "total ms\t%.3f\n", end / 1e3);
+	}
+	
+	if (gTrace && writeTrace(gTrace, end))
+	{
+		fprintf(stderr, "failed to write '%s'\n", gTrace);
+		rval = -1;
+	}
+	
+	for (i = 0; i < gSpanNum; ++i)
+		free(gSpan[i].name);
+	free(gSpan);
+	gSpan = 0;
+	gSpanNum = 0;
+	gSpanCap = 0;
+	gOn = 0;
+	
+	return rval;
+}
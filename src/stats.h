@@ -0,0 +1,69 @@
+/*
+ * stats.h <z64.me>
+ *
+ * optional instrumentation shared by the tools: running counters, and
+ * timed spans that are reported with --stats or written as a chrome
+ * trace-event timeline with --trace
+ *
+ */
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdio.h>
+
+/* counters; each is a total over the whole run, safe to add to from
+ * any thread
+ */
+enum statsCounter {
+	STAT_SCANNED,           /* bytes searched for end markers */
+	STAT_MARKERS,           /* candidate end markers */
+	STAT_NOSTART,           /* candidates rejected, for each reason */
+	STAT_MISALIGNED,
+	STAT_NOROOMS,
+	STAT_ROOMLIST,
+	STAT_CLAIMED,
+	STAT_SCENES,            /* scene headers found */
+	STAT_RIPPED,            /* scenes ripped */
+	STAT_RIPS_CACHED,       /* of which restored from the cache */
+	STAT_ROOMS,             /* rooms converted */
+	STAT_ROOMS_CACHED,      /* of which restored from the cache */
+	STAT_DLISTS,            /* display lists converted */
+	STAT_DLIST_BYTES,       /* bytes of them */
+	STAT_COMMANDS,          /* commands in them, if optimizing */
+	STAT_COMMANDS_OPTIMIZED, /* and how many were left */
+	STAT_UNOPTIMIZED,       /* rooms left as they are, if optimizing */
+	STAT_SUBPROCESSES,      /* external tools run */
+	STAT_SUBPROCESS_US,     /* time spent waiting on them */
+	STAT_READ,              /* bytes of input read */
+	STAT_WRITTEN,           /* bytes of output written */
+	STAT_NUM
+};
+
+/* turns instrumentation on; report prints a summary when it ends, and
+ * trace, if non-zero, is the file a timeline is written to
+ */
+void statsBegin(int report, const char *trace);
+
+/* non-zero if spans are being recorded */
+int statsOn(void);
+
+/* microseconds since statsBegin() */
+double statsNow(void);
+
+/* adds n to a counter */
+void statsAdd(enum statsCounter which, unsigned long long n);
+
+/* records a span of the given category lasting from start until now,
+ * named by a printf-style format; does nothing unless statsOn()
+ */
+void statsSpan(const char *cat, double start, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/* prints the summary to report, if it was asked for, writes the trace,
+ * and releases every span
+ * returns 0 on success, non-zero if the trace couldn't be written
+ */
+int statsEnd(FILE *report);
+
+#endif /* STATS_H_INCLUDED */
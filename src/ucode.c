@@ -0,0 +1,360 @@
+/*
+ * ucode.c <z64.me>
+ *
+ * table-driven display list translation between microcodes; each
+ * source/target pair gets its own translator, built from its opcode
+ * map at compile time
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "ucode.h"
+
+/* big-endian bytes to u32 */
+static inline unsigned beU32(void *bytes)
+{
+	unsigned char *b = bytes;
+	return ((unsigned)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* write u32 as big-endian bytes */
+static inline void wbeU32(void *bytes, unsigned v)
+{
+	unsigned char *b = bytes;
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* how a command changes, besides its opcode; most only need their
+ * opcode replaced and some bits of the first word kept
+ */
+enum fix {
+	FIX_NONE = 0,           /* the target has no such command */
+	FIX_SAME,               /* left as it is */
+	FIX_KEEP,               /* new opcode, masked first word, same second word */
+	FIX_CLEAR,              /* same, but the second word is cleared */
+	FIX_MTX,
+	FIX_MOVEMEM,
+	FIX_VTX,
+	FIX_VTX_F3D,
+	FIX_CLEARGEOMETRYMODE,
+	FIX_SETGEOMETRYMODE,
+	FIX_OTHERMODE,
+	FIX_TEXTURE,
+	FIX_MOVEWORD,
+	FIX_POPMTX,
+	FIX_CULLDL_F3D,
+	FIX_TRI1,
+	FIX_TRI1_F3D
+};
+
+/* what one source opcode becomes */
+struct xlat {
+	unsigned char op;       /* target opcode */
+	unsigned char fix;      /* enum fix */
+	unsigned keep;          /* bits of the first word that carry over */
+};
+
+/* rdp commands are shared by every microcode */
+#define XLAT_RDP \
+	[0xe4 ... 0xff] = { 0, FIX_SAME, 0 }
+
+/* commands f3d and f3dex encode alike, as f3dex2 encodes them */
+#define XLAT_GBI1_GBI2 \
+	[0x00] = { 0xe0, FIX_CLEAR, 0 },                /* G_SPNOOP */ \
+	[0x01] = { 0xda, FIX_MTX, 0 },                  /* G_MTX */ \
+	[0x03] = { 0xdc, FIX_MOVEMEM, 0 },              /* G_MOVEMEM */ \
+	[0x06] = { 0xde, FIX_KEEP, 0x00ff0000 },        /* G_DL */ \
+	[0xb3] = { 0xf1, FIX_KEEP, 0 },                 /* G_RDPHALF_2 */ \
+	[0xb4] = { 0xe1, FIX_KEEP, 0 },                 /* G_RDPHALF_1 */ \
+	[0xb6] = { 0xd9, FIX_CLEARGEOMETRYMODE, 0 },    /* G_CLEARGEOMETRYMODE */ \
+	[0xb7] = { 0xd9, FIX_SETGEOMETRYMODE, 0 },      /* G_SETGEOMETRYMODE */ \
+	[0xb8] = { 0xdf, FIX_CLEAR, 0 },                /* G_ENDDL */ \
+	[0xb9] = { 0xe2, FIX_OTHERMODE, 0 },            /* G_SETOTHERMODE_L */ \
+	[0xba] = { 0xe3, FIX_OTHERMODE, 0 },            /* G_SETOTHERMODE_H */ \
+	[0xbb] = { 0xd7, FIX_TEXTURE, 0xffff00 },       /* G_TEXTURE */ \
+	[0xbc] = { 0xdb, FIX_MOVEWORD, 0 },             /* G_MOVEWORD */ \
+	[0xbd] = { 0xd8, FIX_POPMTX, 0 },               /* G_POPMTX */ \
+	[0xc0] = { 0x00, FIX_KEEP, 0xffffff }           /* G_NOOP */
+
+/* f3dex to f3dex2 */
+static const struct xlat gF3dexF3dex2[256] = {
+	XLAT_RDP,
+	XLAT_GBI1_GBI2,
+	[0x04] = { 0x01, FIX_VTX, 0 },                  /* G_VTX */
+	[0xaf] = { 0xdd, FIX_KEEP, 0xffff },            /* G_LOAD_UCODE */
+	[0xb0] = { 0x04, FIX_KEEP, 0xffffff },          /* G_BRANCH_Z */
+	[0xb1] = { 0x06, FIX_KEEP, 0xffffff },          /* G_TRI2 */
+	[0xb2] = { 0x02, FIX_KEEP, 0xffffff },          /* G_MODIFYVTX */
+	[0xb5] = { 0x06, FIX_KEEP, 0xffffff },          /* G_QUAD (written as tri2) */
+	[0xbe] = { 0x03, FIX_KEEP, 0xffff },            /* G_CULLDL */
+	[0xbf] = { 0x05, FIX_TRI1, 0 },                 /* G_TRI1 */
+};
+
+/* f3d to f3dex2; f3d vertex indices are scaled differently, and it
+ * has no tri2, quad, or z branch
+ */
+static const struct xlat gF3dF3dex2[256] = {
+	XLAT_RDP,
+	XLAT_GBI1_GBI2,
+	[0x04] = { 0x01, FIX_VTX_F3D, 0 },              /* G_VTX */
+	[0xbe] = { 0x03, FIX_CULLDL_F3D, 0 },           /* G_CULLDL */
+	[0xbf] = { 0x05, FIX_TRI1_F3D, 0 },             /* G_TRI1 */
+};
+
+/* f3dex geometry mode bits to f3dex2 geometry mode bits */
+static inline unsigned geometryMode(unsigned m)
+{
+	unsigned r = m & ~0x00003200;
+	
+	if (m & 0x00000200) /* G_SHADING_SMOOTH */
+		r |= 0x00200000;
+	if (m & 0x00001000) /* G_CULL_FRONT */
+		r |= 0x00000200;
+	if (m & 0x00002000) /* G_CULL_BACK */
+		r |= 0x00000400;
+	
+	return r;
+}
+
+/* translate one command in place using a pair's table; inlined into
+ * each pair's translator, so the table is a constant there
+ * returns 0 on success
+ * returns non-zero if the command has no equivalent
+ */
+static inline __attribute__((always_inline))
+int translate(const struct xlat *map, unsigned char *b)
+{
+	const struct xlat *x = map + *b;
+	unsigned w0 = beU32(b);
+	unsigned w1 = beU32(b + 4);
+	unsigned out = (unsigned)x->op << 24 | (w0 & x->keep);
+	
+	/* the usual case; rdp commands, then plain opcode swaps */
+	if (x->fix == FIX_SAME)
+		return 0;
+	if (x->fix != FIX_KEEP)
+	{
+		switch (x->fix)
+		{
+			case FIX_CLEAR:
+				w1 = 0;
+				break;
+			
+			case FIX_MTX:
+			{
+				unsigned p = 0;
+				
+				if (b[1] & 0x01) p |= 0x04; /* G_MTX_PROJECTION */
+				if (b[1] & 0x02) p |= 0x02; /* G_MTX_LOAD */
+				if (b[1] & 0x04) p |= 0x01; /* G_MTX_PUSH */
+				out |= 0x380000 | (p ^ 0x01);
+				break;
+			}
+			
+			case FIX_MOVEMEM:
+			{
+				unsigned idx = b[1];
+				unsigned len = w0 & 0xffff;
+				
+				if (idx == 0x80) /* G_MV_VIEWPORT */
+					out |= 0x08;
+				else if (idx == 0x82) /* G_MV_LOOKATY */
+					out |= (0x18 / 8) << 8 | 0x0a;
+				else if (idx == 0x84) /* G_MV_LOOKATX */
+					out |= 0x0a;
+				else if (idx >= 0x86 && idx <= 0x94) /* G_MV_L0 - G_MV_L7 */
+					out |= (((idx - 0x86) / 2 + 2) * 0x18 / 8) << 8 | 0x0a;
+				else
+					return -1;
+				out |= (((len - 1) / 8) & 0x1f) << 19;
+				break;
+			}
+			
+			case FIX_VTX:
+			{
+				unsigned n = (w0 >> 10) & 0x3f;
+				unsigned v0 = b[1] / 2;
+				
+				out |= n << 12 | ((v0 + n) & 0x7f) << 1;
+				break;
+			}
+			
+			case FIX_VTX_F3D:
+			{
+				unsigned n = ((w0 >> 20) & 0xf) + 1;
+				unsigned v0 = (w0 >> 16) & 0xf;
+				
+				out |= n << 12 | ((v0 + n) & 0x7f) << 1;
+				break;
+			}
+			
+			case FIX_CLEARGEOMETRYMODE:
+				out |= ~geometryMode(w1) & 0xffffff;
+				w1 = 0;
+				break;
+			
+			case FIX_SETGEOMETRYMODE:
+				out |= 0xffffff;
+				w1 = geometryMode(w1);
+				break;
+			
+			case FIX_OTHERMODE:
+			{
+				unsigned sft = b[2];
+				unsigned len = b[3];
+				
+				out |= ((32 - sft - len) & 0xff) << 8 | ((len - 1) & 0xff);
+				break;
+			}
+			
+			case FIX_TEXTURE:
+				out |= (b[3] & 0x7f) << 1;
+				break;
+			
+			case FIX_MOVEWORD:
+			{
+				unsigned idx = b[3];
+				unsigned ofs = w0 >> 8 & 0xffff;
+				
+				/* G_MW_POINTS is G_MW_FORCEMTX in f3dex2, which has
+				 * G_MODIFYVTX instead; the offset is vtx * 40 + where
+				 */
+				if (idx == 0x0c)
+				{
+					unsigned where = ofs % 40;
+					
+					if (where < 0x10 || where > 0x1c || (where & 3))
+						return -1;
+					out = 0x02000000 | where << 16 | (ofs / 40 * 2);
+					break;
+				}
+				
+				if (idx == 0x02) /* G_MW_NUMLIGHT */
+					w1 = ((w1 & 0x7fffffff) / 32 - 1) * 24;
+				else if (idx == 0x0a) /* G_MW_LIGHTCOL */
+					ofs = (ofs / 0x20) * 0x18 + (ofs % 0x20);
+				out |= (idx & 0xff) << 16 | ofs;
+				break;
+			}
+			
+			case FIX_POPMTX:
+				out |= 0x380002;
+				w1 = 64;
+				break;
+			
+			/* f3d gives the end vertex as (vend + 1) * 40 */
+			case FIX_CULLDL_F3D:
+				out |= (w0 & 0xffff) / 40 * 2;
+				w1 = w1 < 40 ? 0 : (w1 / 40 - 1) * 2;
+				break;
+			
+			case FIX_TRI1:
+				out |= w1 & 0xffffff;
+				w1 = 0;
+				break;
+			
+			/* f3d flat shades with the vertex the flag names, f3dex2
+			 * with the first, so the flagged one is rotated to the front
+			 */
+			case FIX_TRI1_F3D:
+			{
+				unsigned v[3] = { b[5] / 10 * 2, b[6] / 10 * 2, b[7] / 10 * 2 };
+				unsigned f = b[4] % 3;
+				
+				out |= v[f] << 16 | v[(f + 1) % 3] << 8 | v[(f + 2) % 3];
+				w1 = 0;
+				break;
+			}
+			
+			default:
+				return -1;
+		}
+	}
+	
+	wbeU32(b, out);
+	wbeU32(b + 4, w1);
+	
+	return 0;
+}
+
+/* stamps out a translator specialized for one table */
+#define UCODE_TRANSLATOR(NAME, MAP, SOURCE) \
+static int NAME(unsigned char *dlist, unsigned sz) \
+{ \
+	unsigned char *b; \
+	\
+	for (b = dlist; b < dlist + sz; b += 8) \
+	{ \
+		if (translate(MAP, b)) \
+		{ \
+			fprintf(stderr, "unsupported " SOURCE " opcode 0x%02x\n", *b); \
+			return -1; \
+		} \
+	} \
+	\
+	return 0; \
+}
+
+UCODE_TRANSLATOR(translateF3dexF3dex2, gF3dexF3dex2, "f3dex")
+UCODE_TRANSLATOR(translateF3dF3dex2, gF3dF3dex2, "f3d")
+
+/* every supported pair; f3dzex encodes everything a room contains the
+ * same way f3dex2 does, so pairs ending in either share a translator,
+ * and either one as the source needs no translating at all
+ */
+static const struct ucodePair gPair[] = {
+	{ "f3dex:f3dex2", 0x06, 0xb8, 0, translateF3dexF3dex2 },
+	{ "f3dex:f3dzex", 0x06, 0xb8, 0, translateF3dexF3dex2 },
+	{ "f3d:f3dex2", 0x06, 0xb8, 0, translateF3dF3dex2 },
+	{ "f3d:f3dzex", 0x06, 0xb8, 0, translateF3dF3dex2 },
+	{ "f3dex2:f3dex2", 0xde, 0xdf, 1, 0 },
+	{ "f3dex2:f3dzex", 0xde, 0xdf, 1, 0 },
+	{ "f3dzex:f3dex2", 0xde, 0xdf, 1, 0 },
+	{ "f3dzex:f3dzex", 0xde, 0xdf, 1, 0 },
+};
+
+#define PAIR_NUM (sizeof(gPair) / sizeof(*gPair))
+
+const struct ucodePair *ucodePairFind(const char *name)
+{
+	char full[64];
+	unsigned i;
+	
+	if (!name || strlen(name) + sizeof(":f3dex2") > sizeof(full))
+		return 0;
+	
+	/* a source alone means f3dex2 as the target */
+	strcpy(full, name);
+	if (!strchr(full, ':'))
+		strcat(full, ":f3dex2");
+	
+	for (i = 0; i < PAIR_NUM; ++i)
+		if (!strcasecmp(gPair[i].name, full))
+			return gPair + i;
+	
+	return 0;
+}
+
+const char *ucodePairList(void)
+{
+	static char list[256];
+	unsigned i;
+	
+	if (!*list)
+	{
+		for (i = 0; i < PAIR_NUM; ++i)
+		{
+			if (i)
+				strcat(list, " ");
+			strcat(list, gPair[i].name);
+		}
+	}
+	
+	return list;
+}
@@ -0,0 +1,41 @@
+/*
+ * ucode.h <z64.me>
+ *
+ * table-driven display list translation between microcodes; each
+ * source/target pair gets its own translator, built from its opcode
+ * map at compile time
+ *
+ */
+
+#ifndef UCODE_H_INCLUDED
+#define UCODE_H_INCLUDED
+
+/* translates sz bytes of display list in place
+ * returns 0 on success, non-zero on a command the target lacks
+ */
+typedef int ucodeTranslate_t(unsigned char *dlist, unsigned sz);
+
+/* a source microcode, a target microcode, and how to get from one to
+ * the other
+ */
+struct ucodePair {
+	const char *name;       /* "source:target", e.g. "f3dex:f3dex2" */
+	unsigned char dl;       /* G_DL of the source */
+	unsigned char enddl;    /* G_ENDDL of the source */
+	int same;               /* non-zero if nothing needs translating */
+	ucodeTranslate_t *translate;
+};
+
+/* the pair rooms have always been converted with */
+#define UCODE_DEFAULT "f3dex:f3dex2"
+
+/* finds a pair by name; a source name alone implies f3dex2 as the
+ * target, and case doesn't matter
+ * returns 0 if there is no such pair
+ */
+const struct ucodePair *ucodePairFind(const char *name);
+
+/* every pair's name, separated by spaces, for usage messages */
+const char *ucodePairList(void);
+
+#endif /* UCODE_H_INCLUDED */
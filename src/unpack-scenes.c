@@ -0,0 +1,125 @@
+/*
+ * unpack-scenes.c <z64.me>
+ *
+ * lists or extracts the files in an archive made by extract-scenes
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+
+#define die(X) { fprintf(stderr, X"\n"); exit(EXIT_FAILURE); }
+
+/* minimal file writer
+ * returns 0 on failure
+ * returns non-zero on success
+ */
+int savefile(const char *fn, const void *dat, const size_t sz)
+{
+	FILE *fp;
+	
+	/* rudimentary error checking returns 0 on any error */
+	if (
+		!fn
+		|| !dat
+		|| !(fp = fopen(fn, "wb"))
+		|| fwrite(dat, 1, sz, fp) != sz
+		|| fclose(fp)
+	)
+		return 0;
+	
+	return 1;
+}
+
+/* makes every directory leading up to the file at path
+ * returns 0 on success, non-zero on failure
+ */
+static int makedirs(char *path)
+{
+	char *slash;
+	
+	for (slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+	{
+		*slash = '\0';
+		if (mkdir(path, 0777) && errno != EEXIST)
+		{
+			*slash = '/';
+			return -1;
+		}
+		*slash = '/';
+	}
+	
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct archive a;
+	const char *dir = ".";
+	int list = 0;
+	size_t i;
+	int fail = 0;
+	
+	if (argc > 1 && !strcmp(argv[1], "-l"))
+	{
+		list = 1;
+		++argv;
+		--argc;
+	}
+	
+	if (argc == 3 && !list)
+		dir = argv[2];
+	else if (argc != 2)
+		die("arguments: unpack-scenes archive [directory]\n"
+			"       unpack-scenes -l archive"
+		);
+	
+	if (archiveOpen(&a, argv[1]))
+		die("failed to read archive");
+	
+	for (i = 0; i < a.entryNum; ++i)
+	{
+		struct archiveEntry *e = a.entry + i;
+		char *path;
+		void *dat;
+		
+		if (list)
+		{
+			fprintf(stdout, "%10lu  %s\n", (unsigned long)e->sz, e->name);
+			continue;
+		}
+		
+		/* nothing is written outside the directory */
+		if (e->name[0] == '/' || strstr(e->name, ".."))
+		{
+			fprintf(stderr, "skipping '%s'\n", e->name);
+			fail = 1;
+			continue;
+		}
+		
+		if (!(path = malloc(strlen(dir) + strlen(e->name) + 2)))
+			die("out of memory");
+		sprintf(path, "%s/%s", dir, e->name);
+		
+		if (!(dat = archiveRead(&a, e))
+			|| makedirs(path)
+			|| !savefile(path, dat, e->sz)
+		)
+		{
+			fprintf(stderr, "failed to extract '%s'\n", e->name);
+			fail = 1;
+		}
+		
+		free(dat);
+		free(path);
+	}
+	
+	archiveClose(&a);
+	
+	return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}